@@ -1069,6 +1069,7 @@ P_SetupLevel
     }
 
     lumpnum = W_GetNumForName (lumpname);
+    W_TRACE_LEVEL(lumpname, lumpnum, ML_BLOCKMAP + 1);
 	
     maplumpinfo = lump_info(lumpnum);
 
@@ -20,6 +20,7 @@
 
 #if USE_WHD
 #include <stdio.h>
+#include <string.h>
 
 #include "deh_main.h"
 #include "i_swap.h"
@@ -76,6 +77,16 @@ static_assert(MAX_FRAME_DRAWABLES < (1u << (8 * sizeof(num_framedrawables))), ""
 framedrawable_t *skytexture_fd;
 uint8_t dc_translation_index;
 byte translated_fds[3];
+// open addressed hash of framedrawable indexes by real_id (translated framedrawables are not in it), reset each frame
+#define FD_HASH_SIZE 256
+#define FD_HASH_EMPTY 0xff
+static_assert(FD_HASH_SIZE >= 2 * MAX_FRAME_DRAWABLES && MAX_FRAME_DRAWABLES <= FD_HASH_EMPTY, "");
+static uint8_t fd_hash[FD_HASH_SIZE];
+// set to 1 to print framedrawable hash probe counts each frame
+#define DEBUG_FD_HASH 0
+#if DEBUG_FD_HASH
+static uint32_t fd_lookups, fd_probes, fd_max_probe;
+#endif
 
 // needed for pre rendering
 const int32_t *whd_sprite_meta;
@@ -133,7 +144,13 @@ void R_GenerateLookup (int texnum)
 
 void reset_framedrawables(void) {
 //    printf("FD %d\n", num_framedrawables);
+#if DEBUG_FD_HASH
+    printf("FD %d lookups %d probes %d (%d per lookup, max %d)\n", num_framedrawables, (int)fd_lookups,
+           (int)fd_probes, fd_lookups ? (int)(fd_probes / fd_lookups) : 0, (int)fd_max_probe);
+    fd_lookups = fd_probes = fd_max_probe = 0;
+#endif
     num_framedrawables = 0;
+    memset(fd_hash, FD_HASH_EMPTY, sizeof(fd_hash));
     translated_fds[0] = translated_fds[1] = translated_fds[2] = 0xff;
     skytexture_fd = lookup_texture(skytexture);
     if (!whd_textures[skytexture].patch_count) {
@@ -146,9 +163,13 @@ void reset_framedrawables(void) {
     }
 }
 
+static inline uint fd_hash_slot(int real_id) {
+    return ((uint32_t)real_id * 0x9e3779b1u) >> 24;
+}
+
 framedrawable_t *lookup_texture(int real_id) {
+    static_assert(FD_HASH_SIZE == 256, ""); // fd_hash_slot
     if (!real_id) return NULL; // E4M5 at least has 0 as texture values
-    // todo hash table
     framedrawable_t *fd = framedrawables;
     if (dc_translation_index) {
         // since the only things translated are the players, we just track one fd per translation index
@@ -158,11 +179,30 @@ framedrawable_t *lookup_texture(int real_id) {
         translated_fds[dc_translation_index-1] = num_framedrawables;
         fd += num_framedrawables;
     } else {
-        for (int i = 0; i < num_framedrawables; i++, fd++) {
-            if (fd->real_id == real_id) {
-                return fd;
+        uint slot = fd_hash_slot(real_id);
+#if DEBUG_FD_HASH
+        uint probe = 1;
+        fd_lookups++;
+#endif
+        while (fd_hash[slot] != FD_HASH_EMPTY) {
+            if (framedrawables[fd_hash[slot]].real_id == real_id) {
+#if DEBUG_FD_HASH
+                fd_probes += probe;
+                if (probe > fd_max_probe) fd_max_probe = probe;
+#endif
+                return &framedrawables[fd_hash[slot]];
             }
+            slot = (slot + 1) & (FD_HASH_SIZE - 1);
+#if DEBUG_FD_HASH
+            probe++;
+#endif
         }
+#if DEBUG_FD_HASH
+        fd_probes += probe;
+        if (probe > fd_max_probe) fd_max_probe = probe;
+#endif
+        fd_hash[slot] = num_framedrawables;
+        fd += num_framedrawables;
     }
     hard_assert(num_framedrawables < MAX_FRAME_DRAWABLES);
     num_framedrawables++;
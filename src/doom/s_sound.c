@@ -548,6 +548,7 @@ void S_StartSound(xy_positioned_t *origin, int sfx_id)
     if (sfx_mut(sfx)->lumpnum < 0)
     {
         sfx_mut(sfx)->lumpnum = I_GetSfxLumpNum(sfx);
+        W_TRACE_CATEGORY(sfx_mut(sfx)->lumpnum, W_TRACE_SFX);
     }
 
     channels[cnum].pitch = pitch;
@@ -714,6 +715,7 @@ void S_ChangeMusic(int musicnum, int looping)
     {
         M_snprintf(namebuf, sizeof(namebuf), "d_%s", DEH_String(music->name));
         music->lumpnum = W_GetNumForName(namebuf);
+        W_TRACE_CATEGORY(music->lumpnum, W_TRACE_MUSIC);
     }
 
 #if !DOOM_SMALL
@@ -59,6 +59,10 @@
 #include "dstrings.h"
 #include "sounds.h"
 
+#if PD_PROFILE
+#include "pd_profile.h"
+#endif
+
 //
 // STATUS BAR DATA
 //
@@ -308,6 +312,9 @@ cheatseq_t	cheat_powerup[7] =
 cheatseq_t cheat_choppers = CHEAT("idchoppers", 0);
 cheatseq_t cheat_clev = CHEAT("idclev", 2);
 cheatseq_t cheat_mypos = CHEAT("idmypos", 0);
+#if PD_PROFILE
+cheatseq_t cheat_profile = CHEAT("idprof", 0);
+#endif
 
 //
 // STATUS BAR CODE
@@ -1422,6 +1429,13 @@ ST_Responder (event_t* ev)
                            players[consoleplayer].mo->xy.y);
                 plyr->message = buf;
             }
+#if PD_PROFILE
+            // 'prof' starts recording render profiles, or stops and dumps them
+            else if (cht_CheckCheat(&cheat_profile, ev->data2))
+            {
+                plyr->message = pd_profile_toggle() ? "Profiling" : "Profile dumped";
+            }
+#endif
         }
 
         // 'clev' change-level cheat
@@ -132,5 +132,23 @@ extern uint8_t *next_video_scroll;
 extern int16_t *wipe_yoffsets_raw; // work area for y offsets
 extern uint8_t *wipe_yoffsets; // position of start of y in each column (clipped 0->200)
 extern uint32_t *wipe_linelookup; // offset of front image from start of screenbuffer (actually address of in PICO_ON_DEVICE)
+#if EL_DISPLAY
+// screen rows the renderer has drawn into the frame buffers for this frame (bit y of word y/32); the EL display only
+// re-converts rows marked here, or affected by overlay, palette or frame changes
+#define DIRTY_ROW_WORDS ((SCREENHEIGHT + 31) / 32)
+extern uint32_t next_dirty_rows[DIRTY_ROW_WORDS];
+// panel luminance of each palette index in the current palette
+extern const uint8_t *el_lum_palette;
+#endif
+#if EL_DIRECT_1B
+// direct 1-bit mode (EL display): level frames are thresholded as they are rendered into column major bit
+// planes (bit n of byte y/8 is row y), one plane per core so the cores never share a byte. the display ORs
+// the two planes together, and only uses the 8-bit frame_buffer for the status bar
+#define EL_COL_BYTES (MAIN_VIEWHEIGHT / 8)
+#define EL_VIEW_Y 28 // row of the view in the 1-bit display buffer (dither maps are indexed by display row)
+extern uint8_t el_col_planes[2][2][SCREENWIDTH * EL_COL_BYTES]; // [frame_index][core]
+extern uint8_t next_frame_direct;
+const uint8_t *el_dither_rows(int dm_id, unsigned int *size, unsigned int *stride);
+#endif
 #endif
 #endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+// core 0's cache of patch decoders: a ring of variable sized entries, found via a hash of the patch number. this is
+// the state and allocation for pd_render.cpp (and pd_patch_cache_test.cpp on the host), which is the only includer
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+extern int pd_frame;
+
+#define PATCH_DECODER_HASH_BITS 8
+#define PATCH_DECODER_HASH_SIZE (1u << PATCH_DECODER_HASH_BITS)
+static int16_t patch_hash_offsets[PATCH_DECODER_HASH_SIZE];
+#define PATCH_DECODER_CIRCULAR_BUFFER_SIZE (2048-256)
+static uint16_t patch_decoder_circular_buf[PATCH_DECODER_CIRCULAR_BUFFER_SIZE];
+static uint16_t patch_decoder_circular_buf_write_pos;
+static uint16_t patch_decoder_circular_buf_write_limit;
+
+struct patch_hash_entry_header {
+    uint16_t patch_num;
+    int16_t next;
+    uint16_t size:15;
+    uint16_t encoding:1;
+};
+
+#define PATCH_HASH_ENTRY_HEADER_HWORDS 3
+static_assert(sizeof(struct patch_hash_entry_header)==2 * PATCH_HASH_ENTRY_HEADER_HWORDS, "");
+
+// entries in patch_decoder_circular_buf are a patch_hash_entry_header, then this, then the decoder (core 1's
+// uncached decoders have no patch_cache_use)
+struct patch_cache_use {
+    uint16_t frame:15;  // pd_frame when last used
+    uint16_t pinned:1;  // psprite or sky decoder
+};
+#define PATCH_CACHE_USE_HWORDS 1
+static_assert(sizeof(struct patch_cache_use)==2 * PATCH_CACHE_USE_HWORDS, "");
+// when the write position reaches an entry used within this many frames (or PATCH_CACHE_PINNED_FRAMES if pinned) it
+// is moved down to the write position rather than freed; at most PATCH_CACHE_MAX_KEEP hwords are moved per allocation
+// so a cache full of hot decoders still makes room
+#define PATCH_CACHE_HOT_FRAMES 2
+#define PATCH_CACHE_PINNED_FRAMES 64
+#define PATCH_CACHE_MAX_KEEP (PATCH_DECODER_CIRCULAR_BUFFER_SIZE / 2)
+
+static inline void patch_cache_init() {
+    memset(patch_hash_offsets, -1, sizeof(patch_hash_offsets));
+    patch_decoder_circular_buf_write_pos = 0;
+    patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+}
+
+static inline int patch_hash(int patch_num) {
+    // fibonacci hashing, so lumps a multiple of the table size apart don't all land in one chain as with the low bits
+    return (uint16_t)(patch_num * 40503u) >> (16 - PATCH_DECODER_HASH_BITS);
+}
+
+static inline patch_cache_use *patch_cache_use_at(int offset) {
+    return (patch_cache_use *)(patch_decoder_circular_buf + offset + PATCH_HASH_ENTRY_HEADER_HWORDS);
+}
+
+static inline void touch_patch_decoder(int offset, bool pin) {
+    patch_cache_use *use = patch_cache_use_at(offset);
+    use->frame = pd_frame;
+    if (pin) use->pinned = 1;
+}
+
+static inline bool keep_patch_decoder(int offset) {
+    const patch_cache_use *use = patch_cache_use_at(offset);
+    unsigned int age = (pd_frame - use->frame) & 0x7fff;
+    return age < (use->pinned ? PATCH_CACHE_PINNED_FRAMES : PATCH_CACHE_HOT_FRAMES);
+}
+
+// the hash chain link which points at the entry at offset
+static int16_t *patch_hash_link(int patch_num, int offset) {
+    int16_t *last = &patch_hash_offsets[patch_hash(patch_num)];
+    while (*last != -1 && *last != offset) {
+        last = &((patch_hash_entry_header *) (patch_decoder_circular_buf + *last))->next;
+    }
+    assert(*last != -1);
+    return last;
+}
+
+// returns positive for existing slot, inverted for where to put
+static inline int patch_offset_or_inverse_slot(int patch_num) {
+    int slot = patch_hash(patch_num);
+    int offset = patch_hash_offsets[slot];
+    while (offset != -1) {
+        patch_hash_entry_header *header = (patch_hash_entry_header *)(patch_decoder_circular_buf + offset);
+        assert(slot == patch_hash(header->patch_num));
+        if (header->patch_num == patch_num) return offset;
+        offset = header->next;
+    }
+    return ~slot;
+}
+
+// makes room for space_needed hwords at the write position, freeing the entries in the way or moving the ones to keep
+// down to it. moved(patch_num, offset) and freed(patch_num) are called so the caller can fix up decoders it holds
+template<typename M, typename F> static void patch_cache_make_room(int space_needed, M moved, F freed) {
+    int keep_budget = PATCH_CACHE_MAX_KEEP;
+    while (patch_decoder_circular_buf_write_pos >=
+           patch_decoder_circular_buf_write_limit - space_needed) {
+        if (patch_decoder_circular_buf_write_limit == PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
+            // we have wrapped; anything moved since the last allocation left stale entries after the write position,
+            // so mark where this lap ends for the next one to stop at
+            if (patch_decoder_circular_buf_write_pos < PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
+                patch_decoder_circular_buf[patch_decoder_circular_buf_write_pos] = 0;
+            }
+            patch_decoder_circular_buf_write_pos = patch_decoder_circular_buf_write_limit = 0;
+        } else {
+            // we need to advance
+            patch_hash_entry_header *header = (patch_hash_entry_header *) (patch_decoder_circular_buf +
+                                                                           patch_decoder_circular_buf_write_limit);
+            if (header->patch_num && header->size <= keep_budget &&
+                keep_patch_decoder(patch_decoder_circular_buf_write_limit)) {
+                // recently used or pinned; move it down to the write position instead
+#if DEBUG_DECODER_BUFFERS
+                printf("Keeping slot (%d) at %08x->%08x\n", header->patch_num, patch_decoder_circular_buf_write_limit, patch_decoder_circular_buf_write_pos);
+#endif
+                unsigned int size = header->size;
+                int patch = header->patch_num;
+                keep_budget -= size;
+                *patch_hash_link(patch, patch_decoder_circular_buf_write_limit) = patch_decoder_circular_buf_write_pos;
+                if (patch_decoder_circular_buf_write_pos != patch_decoder_circular_buf_write_limit) {
+                    memmove(patch_decoder_circular_buf + patch_decoder_circular_buf_write_pos,
+                            patch_decoder_circular_buf + patch_decoder_circular_buf_write_limit, size * 2);
+                }
+                moved(patch, patch_decoder_circular_buf_write_pos);
+                patch_decoder_circular_buf_write_pos += size;
+                patch_decoder_circular_buf_write_limit += size;
+            } else if (header->patch_num) {
+                // free the patch we now encounter
+#if DEBUG_DECODER_BUFFERS
+                printf("Freeing slot (%d) at %08x->%08x\n", header->patch_num, patch_decoder_circular_buf_write_limit, patch_decoder_circular_buf_write_limit + header->size);
+#endif
+                int16_t *last = patch_hash_link(header->patch_num, patch_decoder_circular_buf_write_limit);
+                *last = ((patch_hash_entry_header *) (patch_decoder_circular_buf + *last))->next;
+                freed(header->patch_num);
+                patch_decoder_circular_buf_write_limit += header->size;
+            } else {
+                // we've reached the end of what was there
+                patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+            }
+        }
+    }
+}
+
+// starts a new entry for patch_num at the write position, returning its offset; inverse_slot is from
+// patch_offset_or_inverse_slot
+static inline int patch_cache_insert(int patch_num, int inverse_slot, bool pin) {
+    assert(inverse_slot < 0);
+    unsigned int slot = ~inverse_slot;
+    unsigned int slot_offset = patch_decoder_circular_buf_write_pos;
+    patch_hash_entry_header *header = (patch_hash_entry_header *)(patch_decoder_circular_buf + slot_offset);
+    assert(slot < PATCH_DECODER_HASH_SIZE);
+    header->patch_num = patch_num;
+    header->next = patch_hash_offsets[slot];
+    patch_hash_offsets[slot] = slot_offset;
+    patch_cache_use_at(slot_offset)->pinned = 0;
+    touch_patch_decoder(slot_offset, pin);
+    return slot_offset;
+}
+
+// completes the entry started by patch_cache_insert once its size (including header and use) is known
+static inline void patch_cache_commit(int offset, unsigned int size) {
+    assert(offset == patch_decoder_circular_buf_write_pos);
+    assert(offset + size < PATCH_DECODER_CIRCULAR_BUFFER_SIZE);
+    ((patch_hash_entry_header *)(patch_decoder_circular_buf + offset))->size = size;
+    patch_decoder_circular_buf_write_pos += size;
+    patch_decoder_circular_buf[patch_decoder_circular_buf_write_pos] = 0; // we need a zero patch number to follow
+}
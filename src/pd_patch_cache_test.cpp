@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+// host test for the patch decoder ring (pd_patch_cache.h): drives it the way get_patch_decoder does with random
+// patches, sizes, pins and frame advances, holding a few decoders per "column" across allocations as the column
+// drawing does, and checks after every allocation that the ring, the hash chains and every held decoder are intact.
+// usage: pd_patch_cache_test [allocations] [seed]; exits non zero on the first failure
+
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include "pd_patch_cache.h"
+
+int pd_frame;
+
+#define NUM_PATCHES 400
+#define MAX_DECODER_HWORDS 300
+#define MAX_HELD 4 // WHD_MAX_COL_UNIQUE_PATCHES
+
+struct held_decoder {
+    int patch_num;
+    const uint16_t *decoder;
+};
+
+static uint32_t rng = 1;
+
+static uint32_t next_random() {
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 8;
+}
+
+// the "decoder" stored for a patch, so a corrupted or misplaced entry shows up
+static uint16_t decoder_hword(int patch_num, int i) {
+    return (uint16_t)(patch_num * 977 + i * 13);
+}
+
+static int decoder_hwords(int patch_num) {
+    return 1 + (patch_num * 7919) % MAX_DECODER_HWORDS;
+}
+
+static void fail(unsigned long n, const char *what, int patch_num) {
+    printf("allocation %lu: %s (patch %d) write_pos %d write_limit %d\n", n, what, patch_num,
+           patch_decoder_circular_buf_write_pos, patch_decoder_circular_buf_write_limit);
+    exit(1);
+}
+
+static bool decoder_intact(int patch_num, const uint16_t *decoder) {
+    for (int i = 0; i < decoder_hwords(patch_num); i++) {
+        if (decoder[i] != decoder_hword(patch_num, i)) return false;
+    }
+    return true;
+}
+
+static void check(unsigned long n, const held_decoder *held, int held_count) {
+    if (patch_decoder_circular_buf_write_pos > patch_decoder_circular_buf_write_limit ||
+        patch_decoder_circular_buf_write_limit > PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
+        fail(n, "write position past limit", 0);
+    }
+    int entries = 0;
+    for (unsigned int slot = 0; slot < PATCH_DECODER_HASH_SIZE; slot++) {
+        for (int offset = patch_hash_offsets[slot]; offset != -1;) {
+            if (offset < 0 || offset >= PATCH_DECODER_CIRCULAR_BUFFER_SIZE || ++entries > NUM_PATCHES) {
+                fail(n, "bad hash chain", 0);
+            }
+            const patch_hash_entry_header *header = (const patch_hash_entry_header *)(patch_decoder_circular_buf + offset);
+            int patch_num = header->patch_num;
+            if ((unsigned int)patch_hash(patch_num) != slot) fail(n, "entry in the wrong chain", patch_num);
+            if (header->size != decoder_hwords(patch_num) + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS ||
+                offset + header->size >= PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
+                fail(n, "bad entry size", patch_num);
+            }
+            if (!decoder_intact(patch_num, patch_decoder_circular_buf + offset + PATCH_HASH_ENTRY_HEADER_HWORDS +
+                                           PATCH_CACHE_USE_HWORDS)) {
+                fail(n, "cached decoder corrupted", patch_num);
+            }
+            offset = header->next;
+        }
+    }
+    for (int h = 0; h < held_count; h++) {
+        if (held[h].decoder && !decoder_intact(held[h].patch_num, held[h].decoder)) {
+            fail(n, "held decoder corrupted", held[h].patch_num);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long allocations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    rng = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    patch_cache_init();
+    held_decoder held[MAX_HELD];
+    int held_count = 0;
+    unsigned long n = 0, hits = 0, moves = 0, frees = 0;
+    while (n < allocations) {
+        // a new column every few lookups, and a new frame every so often
+        if (!(next_random() % 3)) held_count = 0;
+        if (!(next_random() % 40)) pd_frame++;
+        // a few hot patches (as for the walls in view) plus a long tail
+        int patch_num = next_random() % 4 ? 1 + next_random() % 24 : 1 + next_random() % NUM_PATCHES;
+        bool pin = !(next_random() % 50);
+        int offset = patch_offset_or_inverse_slot(patch_num);
+        const uint16_t *decoder;
+        if (offset >= 0) {
+            hits++;
+            touch_patch_decoder(offset, pin);
+            decoder = patch_decoder_circular_buf + offset + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS;
+        } else {
+            int space_needed = decoder_hwords(patch_num) + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS;
+            patch_cache_make_room(space_needed, [&](int patch, int to) {
+                moves++;
+                for (int h = 0; h < held_count; h++) {
+                    if (held[h].patch_num == patch && held[h].decoder) {
+                        held[h].decoder = patch_decoder_circular_buf + to + PATCH_HASH_ENTRY_HEADER_HWORDS +
+                                          PATCH_CACHE_USE_HWORDS;
+                    }
+                }
+            }, [&](int patch) {
+                frees++;
+                for (int h = 0; h < held_count; h++) {
+                    if (held[h].patch_num == patch) held[h].decoder = NULL;
+                }
+            });
+            offset = patch_cache_insert(patch_num, offset, pin);
+            uint16_t *d = patch_decoder_circular_buf + offset + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS;
+            for (int i = 0; i < decoder_hwords(patch_num); i++) {
+                d[i] = decoder_hword(patch_num, i);
+            }
+            patch_cache_commit(offset, space_needed);
+            decoder = d;
+            n++;
+        }
+        if (held_count < MAX_HELD) {
+            held[held_count].patch_num = patch_num;
+            held[held_count].decoder = decoder;
+            held_count++;
+        }
+        check(n, held, held_count);
+    }
+    printf("%lu allocations, %lu hits, %lu moves, %lu frees: ok\n", n, hits, moves, frees);
+    return 0;
+}
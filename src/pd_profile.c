@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico.h"
+#include "pico/time.h"
+#if PICO_ON_DEVICE
+#include "hardware/clocks.h"
+#endif
+#include "pd_profile.h"
+
+typedef struct
+{
+    uint32_t frame;
+    uint32_t time[NUM_PD_PROF_TIMES];
+    uint16_t count[NUM_PD_PROF_COUNTS];
+} pd_profile_frame_t;
+
+static const char *const time_names[NUM_PD_PROF_TIMES] =
+{
+    [PD_PROF_FRAME] = "frame",
+    [PD_PROF_WAIT_DISPLAY] = "wait_display",
+    [PD_PROF_SETUP] = "setup",
+    [PD_PROF_COLUMNS0] = "columns0",
+    [PD_PROF_WAIT_CORE1] = "wait_core1",
+    [PD_PROF_FUZZ] = "fuzz",
+    [PD_PROF_FINISH] = "finish",
+    [PD_PROF_FLATS] = "flats",
+    [PD_PROF_COLUMNS1] = "columns1",
+    [PD_PROF_PREFETCH] = "prefetch",
+    [PD_PROF_IDLE1] = "idle1",
+};
+
+static const char *const count_names[NUM_PD_PROF_COUNTS] =
+{
+    [PD_PROF_FRAMEDRAWABLES] = "framedrawables",
+    [PD_PROF_DECODER_HITS] = "decoder_hits",
+    [PD_PROF_DECODER_MISSES] = "decoder_misses",
+    [PD_PROF_FLATS_DECODED] = "flats_decoded",
+    [PD_PROF_FLAT_HITS] = "flat_hits",
+    [PD_PROF_COLUMNS] = "columns",
+    [PD_PROF_COLUMN_OVERFLOW] = "column_overflow",
+    [PD_PROF_VISPLANES] = "visplanes",
+};
+
+// the frame being rendered, kept per core as the M0+ has no atomic add
+static uint32_t frame_time[2][NUM_PD_PROF_TIMES];
+static uint16_t frame_count[2][NUM_PD_PROF_COUNTS];
+static uint32_t frame_number;
+
+static pd_profile_frame_t ring[PD_PROFILE_FRAMES];
+static unsigned int ring_next, ring_used;
+static bool recording;
+
+#if !PICO_ON_DEVICE
+static FILE *csv;
+#endif
+
+
+static void write_header(FILE *f)
+{
+#if PICO_ON_DEVICE
+    fprintf(f, "# times in us, clk_sys %u Hz\n", (unsigned int)clock_get_hz(clk_sys));
+#else
+    fprintf(f, "# times in us\n");
+#endif
+    fprintf(f, "frame");
+    for (int i = 0; i < NUM_PD_PROF_TIMES; i++)
+    {
+        fprintf(f, ",%s", time_names[i]);
+    }
+    for (int i = 0; i < NUM_PD_PROF_COUNTS; i++)
+    {
+        fprintf(f, ",%s", count_names[i]);
+    }
+    fprintf(f, "\n");
+}
+
+
+static void write_row(FILE *f, const pd_profile_frame_t *pf)
+{
+    fprintf(f, "%u", (unsigned int)pf->frame);
+    for (int i = 0; i < NUM_PD_PROF_TIMES; i++)
+    {
+        fprintf(f, ",%u", (unsigned int)pf->time[i]);
+    }
+    for (int i = 0; i < NUM_PD_PROF_COUNTS; i++)
+    {
+        fprintf(f, ",%u", pf->count[i]);
+    }
+    fprintf(f, "\n");
+}
+
+
+#if !PICO_ON_DEVICE
+static void close_csv(void)
+{
+    fclose(csv);
+}
+#endif
+
+
+void pd_profile_init(void)
+{
+#if !PICO_ON_DEVICE
+    const char *s = getenv("PD_PROFILE");
+
+    if (s)
+    {
+        csv = fopen(s, "w");
+        if (!csv)
+        {
+            fprintf(stderr, "PD_PROFILE: can't open %s\n", s);
+            return;
+        }
+        write_header(csv);
+        atexit(close_csv);
+    }
+#endif
+}
+
+
+uint32_t pd_profile_time_us(void)
+{
+    return time_us_32();
+}
+
+
+void pd_profile_add_time(int which, uint32_t us)
+{
+    frame_time[get_core_num()][which] += us;
+}
+
+
+void pd_profile_count(int which, int n)
+{
+    frame_count[get_core_num()][which] += n;
+}
+
+
+// called by core 0 at the end of pd_end_frame, when core 1 is done with the frame
+void pd_profile_end_frame(void)
+{
+    pd_profile_frame_t pf;
+
+    pf.frame = frame_number++;
+    for (int i = 0; i < NUM_PD_PROF_TIMES; i++)
+    {
+        pf.time[i] = frame_time[0][i] + frame_time[1][i];
+    }
+    for (int i = 0; i < NUM_PD_PROF_COUNTS; i++)
+    {
+        pf.count[i] = frame_count[0][i] + frame_count[1][i];
+    }
+    memset(frame_time, 0, sizeof(frame_time));
+    memset(frame_count, 0, sizeof(frame_count));
+    if (recording)
+    {
+        ring[ring_next] = pf;
+        ring_next = (ring_next + 1) % PD_PROFILE_FRAMES;
+        if (ring_used < PD_PROFILE_FRAMES)
+        {
+            ring_used++;
+        }
+    }
+#if !PICO_ON_DEVICE
+    if (csv)
+    {
+        write_row(csv, &pf);
+    }
+#endif
+}
+
+
+bool pd_profile_toggle(void)
+{
+    recording = !recording;
+    if (recording)
+    {
+        ring_next = ring_used = 0;
+    }
+    else
+    {
+        // oldest first
+        write_header(stdout);
+        for (unsigned int i = 0; i < ring_used; i++)
+        {
+            write_row(stdout, &ring[(ring_next + PD_PROFILE_FRAMES - ring_used + i) % PD_PROFILE_FRAMES]);
+        }
+    }
+    return recording;
+}
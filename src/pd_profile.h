@@ -0,0 +1,77 @@
+#ifndef _PD_PROFILE_H
+#define _PD_PROFILE_H
+
+// per frame render profile (PD_PROFILE builds; cmake -DPICO_DOOM_PROFILE=TRUE). every frame pd_render records the time
+// spent in each phase on each core, plus a few counters; then:
+//
+//   on the device, the "idprof" cheat starts recording the last PD_PROFILE_FRAMES frames into a ring buffer, and
+//   entering it again stops recording and dumps the ring as CSV over stdio
+//   in host builds, PD_PROFILE=<file> (an environment variable, as the doom_tiny builds have no command line
+//   arguments) writes every frame to <file> as CSV; the cheat works too
+//
+// times are in microseconds from the timer both cores share (the M0+ has no cycle counter, and each core's 24-bit
+// SysTick wraps within a slow frame); the CSV header gives clk_sys so they can be turned into cycles
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PD_PROFILE_FRAMES
+#define PD_PROFILE_FRAMES 32
+#endif
+
+enum
+{
+    PD_PROF_FRAME,              // core 0: pd_end_frame as a whole
+    PD_PROF_WAIT_DISPLAY,       // core 0: waiting for the display to free a frame buffer
+    PD_PROF_SETUP,              // core 0: wipes, flat slots, predraw_visplanes
+    PD_PROF_COLUMNS0,           // core 0: sorting columns by frame drawable, then regular columns
+    PD_PROF_WAIT_CORE1,         // core 0: waiting for core 1 to finish
+    PD_PROF_FUZZ,               // both cores: fuzz columns
+    PD_PROF_FINISH,             // core 0: patch lists, menus
+    PD_PROF_FLATS,              // core 1 (core 0 without USE_CORE1_FOR_FLATS): visplanes
+    PD_PROF_COLUMNS1,           // core 1: regular columns
+    PD_PROF_PREFETCH,           // core 1: flat prefetch
+    PD_PROF_IDLE1,              // core 1: waiting for core 0 to finish (includes the prefetch)
+    NUM_PD_PROF_TIMES
+};
+
+enum
+{
+    PD_PROF_FRAMEDRAWABLES,     // composite textures and patches drawn
+    PD_PROF_DECODER_HITS,       // patch decoders found in the core 0 cache
+    PD_PROF_DECODER_MISSES,     // patch decoders built
+    PD_PROF_FLATS_DECODED,
+    PD_PROF_FLAT_HITS,          // flats drawn from a cache slot
+    PD_PROF_COLUMNS,            // render columns in the list at the end of the frame
+    PD_PROF_COLUMN_OVERFLOW,    // visible columns dropped for lack of space
+    PD_PROF_VISPLANES,
+    NUM_PD_PROF_COUNTS
+};
+
+#if PD_PROFILE
+void pd_profile_init(void);
+uint32_t pd_profile_time_us(void);
+void pd_profile_add_time(int which, uint32_t us);
+void pd_profile_count(int which, int n);
+void pd_profile_end_frame(void);
+// start or stop (and dump) recording; returns whether now recording
+bool pd_profile_toggle(void);
+
+#define PD_PROFILE_START(t) uint32_t t = pd_profile_time_us()
+#define PD_PROFILE_END(which, t) pd_profile_add_time(which, pd_profile_time_us() - (t))
+#define PD_PROFILE_COUNT(which, n) pd_profile_count(which, n)
+#else
+#define PD_PROFILE_START(t) ((void)0)
+#define PD_PROFILE_END(which, t) ((void)0)
+#define PD_PROFILE_COUNT(which, n) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
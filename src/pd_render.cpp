@@ -12,12 +12,14 @@
 #include "hardware/gpio.h"
 #include "pico/divider.h"
 #include "image_decoder.h"
+#include "tiny_rans.h"
 #include <set>
 extern "C" {
 #include "doom/d_main.h"
 #include "doom/r_data.h"
 #include "doom/r_sky.h"
 #include "doom/r_things.h"
+#include "doom/p_spec.h"
 #include "doom/m_menu.h"
 #include "doom/doomstat.h"
 #include "doom/am_map.h"
@@ -29,6 +31,7 @@ extern "C" {
 #include "doom/f_finale.h"
 #include "v_video.h"
 #include "i_video.h"
+#include "pd_profile.h"
 }
 // todo compare with and without
 #define USE_XIPCPY 0
@@ -50,11 +53,15 @@ semaphore_t core1_wake, core0_done, core1_done;
 
 #if USE_CORE1_FOR_FLATS
 semaphore_t core1_do_flats;
-int16_t core1_fr_list;
 #endif
 #if USE_CORE1_FOR_REGULAR
 semaphore_t core1_do_regular;
 #endif
+#if USE_CORE1_FOR_FLATS && USE_CORE1_FOR_REGULAR
+// both cores draw fuzz columns once both have finished their regular columns
+#define USE_CORE1_FOR_FUZZ 1
+semaphore_t core1_regular_done;
+#endif
 pre_wipe_state_t pre_wipe_state;
 static int16_t sub_gamestate;
 // todo look at using scratch RAM for local linked lists/buffers (we sort of have this with stack)
@@ -100,15 +107,9 @@ wipestate_t wipestate;
 static uint8_t post_wipecount;
 
 // todo these are only needed temporarily, so stack or "tmp buffer"
-static uint16_t flat_decoder_buf[WHD_FLAT_DECODER_MAX_SIZE];
+static __aligned(4) uint16_t flat_decoder_buf[WHD_FLAT_DECODER_MAX_SIZE]; // also a tiny_rans syms table
 static uint8_t flat_decoder_tmp[WHD_FLAT_DECODER_MAX_SIZE];
-#define PATCH_DECODER_HASH_SIZE 128
-static_assert(__builtin_popcount(PATCH_DECODER_HASH_SIZE)==1, "");
-static int16_t patch_hash_offsets[PATCH_DECODER_HASH_SIZE];
-#define PATCH_DECODER_CIRCULAR_BUFFER_SIZE (2048-256)
-static uint16_t patch_decoder_circular_buf[PATCH_DECODER_CIRCULAR_BUFFER_SIZE];
-static uint16_t patch_decoder_circular_buf_write_pos;
-static uint16_t patch_decoder_circular_buf_write_limit;
+#include "pd_patch_cache.h"
 // this is used when decoding decoders, but also as a cache for up to 4 decoder tables (each of which are 256 bytes big)
 static uint8_t patch_decoder_tmp[256 * WHD_MAX_COL_UNIQUE_PATCHES];
 // which patch decoder table (or 0 if none) is stored in each of the 256 byte areas in patch_decoder_tmp
@@ -118,6 +119,12 @@ static uint16_t patch_decoder_tmp_table_patch_numbers[WHD_MAX_COL_UNIQUE_PATCHES
 static uint32_t not_fully_covered_cols[(SCREENWIDTH/4 + 31)/32];
 static uint8_t not_fully_covered_yl, not_fully_covered_yh;
 static int16_t fd_heads[MAX_FRAME_DRAWABLES]; // frame drawable linked lists
+// regular column work shared by both cores: the frame drawables that have columns, most columns first, claimed from
+// the front by whichever core is free
+static uint16_t fd_col_counts[MAX_FRAME_DRAWABLES];
+static uint8_t fd_queue[MAX_FRAME_DRAWABLES];
+static uint8_t fd_queue_size;
+static uint8_t fd_queue_next; // protected by RENDER_SPIN_LOCK
 vpatchlists_t *vpatchlists;
 int16_t visplane_heads[MAXVISPLANES];
 int8_t flatnum_next[MAXVISPLANES];
@@ -168,12 +175,46 @@ int pd_flag;
 fixed_t pd_scale;
 
 extern uint8_t __aligned(4) frame_buffer[2][SCREENWIDTH * MAIN_VIEWHEIGHT];
-static uint8_t __aligned(4) visplane_bit[(SCREENWIDTH / 8) * MAIN_VIEWHEIGHT]; // this is also used for patch decoding in core1 (since flats are done by then)
+// core 1 scratch. while drawing flats it holds the start of the open span in each row (and just before, core 0 keeps
+// the visplane list tails there). once its flats are drawn, it holds core 1's patch column buffer, then a decoder and
+// decoder table for each of the (up to WHD_MAX_COL_UNIQUE_PATCHES) patches of a composite texture, as core 1 has no
+// decoder cache
+#define CORE1_DECODER_HWORDS WHD_FLAT_DECODER_MAX_SIZE
+#define CORE1_DECODERS_OFFSET ((WHD_PATCH_MAX_WIDTH * 3 + 3) & ~3)
+#define CORE1_DECODER_TABLES_OFFSET (CORE1_DECODERS_OFFSET + WHD_MAX_COL_UNIQUE_PATCHES * CORE1_DECODER_HWORDS * 2)
+#define CORE1_SCRATCH_SIZE (CORE1_DECODER_TABLES_OFFSET + WHD_MAX_COL_UNIQUE_PATCHES * 256)
+static uint8_t __aligned(4) core1_scratch[CORE1_SCRATCH_SIZE];
+#define span_x_start ((uint16_t *)core1_scratch) // [MAIN_VIEWHEIGHT]
+#define visplane_tails ((int16_t *)(core1_scratch + MAIN_VIEWHEIGHT * 2)) // [MAXVISPLANES]
+static_assert(MAIN_VIEWHEIGHT * 2 + MAXVISPLANES * 2 <= CORE1_SCRATCH_SIZE, "");
+static uint16_t core1_decoder_table_patch_numbers[WHD_MAX_COL_UNIQUE_PATCHES];
 static int8_t flatnum_first[256];
 
 static uint8_t *render_frame_buffer;
 static uint8_t render_frame_index;
 static uint8_t render_overlay_index;
+#if EL_DIRECT_1B
+// the view for this frame goes straight to el_col_planes; render_frame_buffer then only holds visplane identifiers
+static bool render_direct;
+static uint8_t render_dm_id;
+
+// each core has its own plane, so column bytes are never shared between the cores
+static inline uint8_t *el_col_bits(int x) {
+    return el_col_planes[render_frame_index][get_core_num()] + x * EL_COL_BYTES;
+}
+#endif
+#if EL_DISPLAY
+static uint32_t render_dirty_rows[DIRTY_ROW_WORDS];
+#endif
+
+// note screen rows (top inclusive, bottom exclusive) drawn into a frame buffer this frame
+static inline void mark_rows_dirty(int top, int bottom) {
+#if EL_DISPLAY
+    for (int y = top; y < bottom; y++) {
+        render_dirty_rows[y >> 5] |= 1u << (y & 31);
+    }
+#endif
+}
 
 static_assert(NO_USE_DC_COLORMAP, "");
 static_assert(USE_ROWAD, ""); // don't want things moving!
@@ -252,16 +293,7 @@ struct pd_column {
 #define TO_COL_LO(c) ((c)&0x1f)
 #define FROM_COL_HI_LO(h,l) (((h)<<5)|(l))
 
-struct __packed __aligned(2) flat_run {
-    int16_t next;
-    uint32_t x_start: 12;
-    uint32_t x_end: 12;
-    uint32_t y: 8;
-};
-
-static_assert(sizeof(flat_run) == 6, "");
 static_assert(sizeof(pd_column) == 12, "");
-static_assert(sizeof(pd_column) == sizeof(flat_run) * 2, ""); // we pack two into the space of the other
 
 static __aligned(4) int16_t column_heads[SCREENWIDTH * 2];
 #define fuzzy_column_heads (&column_heads[SCREENWIDTH])
@@ -318,23 +350,57 @@ const char *type_name(pd_column column) {
 }
 
 #define RENDER_COL_MAX 3600
-static uint8_t __aligned(4) list_buffer[RENDER_COL_MAX * sizeof(pd_column) + 64*64]; // extra 64*64 is for one flat
+// number of decoded flats that always fit alongside a full column list; any space the column list doesn't use holds more
+#ifndef PD_MIN_CACHED_FLATS
+#define PD_MIN_CACHED_FLATS 1
+#endif
+static_assert(PD_MIN_CACHED_FLATS >= 1, "");
+// decode the sky patch into a 16K strip once per level, rather than every frame (cmake -DPICO_DOOM_SKY_STRIP=TRUE)
+#ifndef PD_SKY_STRIP
+#define PD_SKY_STRIP 0
+#endif
+#if PD_SKY_STRIP
+#if !EL_DISPLAY
+#error PD_SKY_STRIP picks the sky colors by panel luminance, so needs EL_DISPLAY
+#endif
+static void build_sky_strip();
+static int sky_strip_patch = -1; // the patch in sky_strip, or -1
+static int sky_strip_checked = -1; // the patch build_sky_strip last looked at (it may not fit), or -1
+#endif
+static uint8_t __aligned(4) list_buffer[RENDER_COL_MAX * sizeof(pd_column) + PD_MIN_CACHED_FLATS * 64*64]; // extra 64*64s are for flats
 static uint8_t *last_list_buffer_limit = list_buffer + sizeof(list_buffer);
 //static_assert(text_font_cpy > list_buffer, "");
 #define MAX_CACHED_FLATS (sizeof(list_buffer) / 4096)
+// decoded flats are kept from frame to frame (slot n is at cached_flat0 - n * 4096) until the column list grows over
+// them, or they are evicted least recently used first
 static uint8_t cached_flat_picnum[MAX_CACHED_FLATS];
+static uint16_t cached_flat_last_use[MAX_CACHED_FLATS]; // value of flat_use_clock when the slot was last drawn from
+static uint16_t flat_use_clock;
 static uint8_t cached_flat_slots;
 static uint8_t *cached_flat0;
+#if USE_CORE1_FOR_FLATS
+// a flat from a sector next to the viewer's which isn't cached yet (or 0xff); core 1 decodes it while waiting for core 0
+// so that it is already there when it comes into view
+static uint8_t prefetch_flat_picnum = 0xff;
+#endif
 static int16_t render_col_count;
+// how many columns this frame may use; everything in list_buffer that isn't the PD_MIN_CACHED_FLATS flat slots (or
+// wipe data), set at the start of the frame
+static int16_t render_col_budget = RENDER_COL_MAX;
 #define render_cols ((pd_column *)list_buffer)
-#define flat_runs ((flat_run *)list_buffer)
 static int16_t render_col_free;
 
+#define DEBUG_COL_BUDGET 0
+// per frame column stats (reset in pd_begin_frame): visible columns (or parts) dropped because the budget ran out, and
+// columns not stored at all because they were already hidden
+static uint16_t render_col_overflow, render_col_hidden;
+
 static int16_t alloc_pd_column(int x) {
     if (render_col_free < 0) {
-        if (render_col_count == RENDER_COL_MAX) {
+        if (render_col_count >= render_col_budget) {
             assert(x>=0 && x<SCREENWIDTH);
             not_fully_covered_cols[x/(4*32)] |= 1u << ((x/4)&31);
+            render_col_overflow++;
             return -1;
         }
         render_col_free = render_col_count++;
@@ -352,6 +418,44 @@ static void free_pd_column(int16_t rc_index) {
     render_col_free = rc_index;
 }
 
+// column_hidden leaves the link to the first column in x which isn't entirely above yl, so inserting there doesn't need
+// to walk the list from its head again. it stays valid until the list for x changes (only push_down_x_guts does that)
+// and serves any insertion starting at or below column_insert_hint_yl
+static int16_t column_insert_hint_x = -1;
+static uint8_t column_insert_hint_yl;
+static int16_t *column_insert_hint_link;
+
+static inline int16_t *column_insert_link(int x, int yl) {
+    if (x == column_insert_hint_x && yl >= column_insert_hint_yl) return column_insert_hint_link;
+    return &column_heads[x];
+}
+
+// true if yl->yh at scale would be entirely behind columns already in x; such a column would only be freed again by
+// push_down_x, so we don't allocate it at all (which matters when the budget is nearly used up). columns are inserted
+// roughly front to back, so this catches most sprites and masked columns behind walls
+static bool column_hidden(int x, int yl, int yh, uint32_t scale) {
+    scale &= 0xffffff; // as stored in pd_column
+    int16_t *link = column_insert_link(x, yl);
+    while (*link >= 0 && render_cols[*link].yh < yl) link = &render_cols[*link].next;
+    // keep the hint for the lowest yl (masked columns check each of their segments before inserting them all)
+    if (x != column_insert_hint_x || yl < column_insert_hint_yl) {
+        column_insert_hint_x = x;
+        column_insert_hint_yl = yl;
+        column_insert_hint_link = link;
+    }
+    for (int16_t i = *link; i >= 0; i = render_cols[i].next) {
+        const pd_column &c = render_cols[i];
+        // a gap, or a column behind us (push_down_x puts the new column in front only if its scale is strictly less)
+        if (c.yl > yl || scale < c.scale) return false;
+        yl = c.yh + 1;
+        if (yl > yh) {
+            render_col_hidden++;
+            return true;
+        }
+    }
+    return false;
+}
+
 #if DUMP_SORTING
 
 const char *column_desc(int index) {
@@ -385,8 +489,9 @@ static void dump_column(int x, const char *prefix) {
 
 // new_index can be a (non overlapping) linked list (in ascending y order)
 static void push_down_x_guts(int x, int16_t new_index) {
-    int16_t *prev_existing_ptr = &column_heads[x];
+    int16_t *prev_existing_ptr = column_insert_link(x, render_cols[new_index].yl);
     int16_t existing_index = *prev_existing_ptr;
+    column_insert_hint_x = -1;
 //    dump_column(x, "before");
 //    dump_column_list(x, "Want to insert", new_index);
 //    if (pd_frame == 176 && x == 174) {
@@ -586,7 +691,7 @@ static void push_down_x_guts(int x, int16_t new_index) {
 // new_index can be a (non overlapping) linked list (in ascending y order)
 // for fuzzy columns we're just clipping the new columns against the existing stuff
 static void push_down_x_fuzzy(int x, int16_t new_index) {
-    int16_t existing_index = column_heads[x];
+    int16_t existing_index = *column_insert_link(x, render_cols[new_index].yl);
 //    dump_column(x, "before");
 //    dump_column(x+SCREENWIDTH, "before fuzz");
 //    if (x == 478 - SCREENWIDTH && new_index == 246) {
@@ -770,6 +875,11 @@ void pd_begin_frame() {
     sem_release(&core1_wake);
 
     reset_framedrawables();
+#if PD_SKY_STRIP
+    if (gamestate == GS_LEVEL && skytexture_patch != sky_strip_checked) {
+        build_sky_strip();
+    }
+#endif
 #if !PICO_ON_DEVICE
     textures.clear();
     patches.clear();
@@ -779,12 +889,17 @@ void pd_begin_frame() {
 #endif
     // new
     memset(column_heads, -1, sizeof(column_heads));
-    memset(visplane_bit, 0, sizeof(visplane_bit)); // todo could do this with dma
+    column_insert_hint_x = -1;
     for(uint i=0;i<count_of(not_fully_covered_cols);i++) not_fully_covered_cols[i] = 0; // only 3 of these so loop
     not_fully_covered_yl = 0;
     not_fully_covered_yh = MAIN_VIEWHEIGHT - 1;
     render_col_count = 0;
     render_col_free = -1;
+    // the flat slots are carved from the top of list_buffer in pd_end_frame; anticipate the same limit here, so we only
+    // need to discard columns when a wipe starts this frame
+    uint8_t *list_buffer_limit = std::min(list_buffer + sizeof(list_buffer) - (wipestate ? 4096 : 0), last_list_buffer_limit);
+    render_col_budget = (list_buffer_limit - PD_MIN_CACHED_FLATS * 4096 - list_buffer) / (int)sizeof(pd_column);
+    render_col_overflow = render_col_hidden = 0;
     pd_frame++;
     DEBUG_PINS_CLR(start_end, 1);
 }
@@ -815,6 +930,9 @@ void pd_init() {
     sem_init(&core1_wake, 0, 1);
     sem_init(&core0_done, 0, 1);
     sem_init(&core1_done, 0, 1);
+#if PD_PROFILE
+    pd_profile_init();
+#endif
 #if PICO_ON_DEVICE
     static_assert(sizeof(vpatchlists_t) < 0xc00, "");
     vpatchlists = (vpatchlists_t *)(USBCTRL_DPRAM_BASE + 0x400);
@@ -826,11 +944,13 @@ void pd_init() {
 #if USE_CORE1_FOR_FLATS
     sem_init(&core1_do_flats, 0, 1);
 #endif
+#if USE_CORE1_FOR_FUZZ
+    sem_init(&core1_regular_done, 0, 1);
+#endif
 #if USE_CORE1_FOR_REGULAR
     sem_init(&core1_do_regular, 0, 1);
 #endif
-    memset(patch_hash_offsets, -1, sizeof(patch_hash_offsets));
-    patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+    patch_cache_init();
 }
 
 void pd_add_span() {
@@ -866,7 +986,7 @@ void pd_add_column(pd_column_type type) {
     if (texturemid > MAXI) texturemid = MAXI;
     // --------
 
-    // todo it would be nice to defer filling this in in case we are entirely clipped - let's get some stats on that
+    if (column_hidden(dc_x, dc_yl, dc_yh, pd_flag & 2 ? 0 : iscale)) return;
     int rc_index = alloc_pd_column(dc_x);
     if (rc_index < 0) return;
     render_cols[rc_index].yl = dc_yl;
@@ -962,15 +1082,20 @@ void pd_add_masked_columns(uint8_t *ys, int seg_count) {
     }
     // --------
 
-    // todo it would be nice to defer filling this in in case we are entirely clipped - let's get some stats on that
+    uint32_t scale = pd_flag & 2 ? 0 : iscale;
+    // skip any leading segments which are already hidden
+    int seg = 0;
+    while (column_hidden(dc_x, ys[seg * 3], ys[seg * 3 + 1], scale)) {
+        if (++seg == seg_count) return;
+    }
     int rc_index = alloc_pd_column(dc_x);
     if (rc_index < 0) return;
-    render_cols[rc_index].yl = ys[0];
-    render_cols[rc_index].yh = ys[1];
+    render_cols[rc_index].yl = ys[seg * 3];
+    render_cols[rc_index].yh = ys[seg * 3 + 1];
     assert(render_cols[rc_index].yl >= 0 && render_cols[rc_index].yl < MAIN_VIEWHEIGHT && render_cols[rc_index].yh >= 0 && render_cols[rc_index].yh < MAIN_VIEWHEIGHT);
 
-    assert(ys[1] >= ys[0]);
-    render_cols[rc_index].scale = pd_flag & 2 ? 0 : iscale;
+    assert(ys[seg * 3 + 1] >= ys[seg * 3]);
+    render_cols[rc_index].scale = scale;
     render_cols[rc_index].colormap_index = dc_colormap_index;
 #if !FORCE_ISCALE
     if (type != PDCOL_SKY) {
@@ -1003,12 +1128,13 @@ void pd_add_masked_columns(uint8_t *ys, int seg_count) {
         textures.insert(dc_source.real_id);
     }
 #endif
-    fixed_t texturemid = dc_texturemid - (ys[2] << FRACBITS);
+    fixed_t texturemid = dc_texturemid - (ys[seg * 3 + 2] << FRACBITS);
     if (texturemid < MINI) texturemid = MINI;
     if (texturemid > MAXI) texturemid = MAXI;
     render_cols[rc_index].texturemid = DOWN_SHIFT(texturemid);
     int first_index = rc_index;
-    for (int i = 1; i < seg_count; i++) {
+    for (int i = seg + 1; i < seg_count; i++) {
+        if (column_hidden(dc_x, ys[i * 3], ys[i * 3 + 1], scale)) continue;
         int new_rc_index = alloc_pd_column(dc_x);
         if (new_rc_index < 0) break;
         render_cols[new_rc_index] = render_cols[rc_index];
@@ -1025,7 +1151,9 @@ void pd_add_masked_columns(uint8_t *ys, int seg_count) {
     }
     render_cols[rc_index].next = -1;
     if (dc_colormap_index < 0) {
-        push_down_x_fuzzy(dc_x, first_index);
+        // fuzzy columns are clipped once, by reclip_fuzz_columns, when everything in front of them has been added
+        render_cols[rc_index].next = fuzzy_column_heads[dc_x];
+        fuzzy_column_heads[dc_x] = first_index;
     } else {
         push_down_x(dc_x, first_index);
     }
@@ -1081,12 +1209,13 @@ static int lightlevel(int visplane) {
 }
 
 void pd_add_plane_column(int x, int yl, int yh, fixed_t scale, int floor, int fd_num) {
-    int rc_index = alloc_pd_column(x);
-    if (rc_index < 0) return;
-    int iscale = hw_divider_u32_quotient_inlined(0xffffffff, pd_scale);
     if (yh < yl) {
         return;
     }
+    int iscale = hw_divider_u32_quotient_inlined(0xffffffff, pd_scale);
+    if (column_hidden(x, yl, yh, pd_flag & 2 ? 0 : iscale)) return;
+    int rc_index = alloc_pd_column(x);
+    if (rc_index < 0) return;
     render_cols[rc_index].yl = yl;
     render_cols[rc_index].yh = yh;
     assert(render_cols[rc_index].yl >= 0 && render_cols[rc_index].yl < MAIN_VIEWHEIGHT && render_cols[rc_index].yh >= 0 && render_cols[rc_index].yh < MAIN_VIEWHEIGHT);
@@ -1099,7 +1228,7 @@ void pd_add_plane_column(int x, int yl, int yh, fixed_t scale, int floor, int fd
 }
 
 static void reclip_fuzz_columns() {
-    // re-add the fuzzy columns so they are correctly clipped
+    // add the fuzzy columns now everything which may obscure them is in the column lists
     for (int x = 0; x < SCREENWIDTH; x++) {
         int16_t cur = fuzzy_column_heads[x];
         fuzzy_column_heads[x] = -1;
@@ -1112,34 +1241,30 @@ static void reclip_fuzz_columns() {
     }
 }
 
-static int16_t predraw_visplanes() {
-    int16_t free_list = -1;
+// move the plane columns out of the column lists into a list per visplane, in x then y order, for draw_visplanes to
+// make spans from (x goes in scale, which isn't needed for them any more)
+static void predraw_visplanes() {
+    if (!lastvisplane) return;
+    int numvisplanes = lastvisplane - visplanes;
+    memset(visplane_heads, -1, numvisplanes * sizeof(visplane_heads[0]));
     for (int x = 0; x < SCREENWIDTH; x++) {
-        uint8_t *screen_col = render_frame_buffer + x;
-        uint8_t *visplane_bit_col = visplane_bit + x / 8;
-        uint8_t visplane_bit_bit = 1u << (x & 7u);
         int16_t *last = &column_heads[x];
         int16_t i = *last;
         while (i >= 0) {
             auto &c = render_cols[i];
-            uint8_t *p = screen_col + c.yl * SCREENWIDTH;
-            uint8_t color = c.plane;
-//            printf("%d: %d -> %d %02x %d\n", x, c.yl, c.yh, color, c.texturemid == TEXTUREMID_PLANE);
+//            printf("%d: %d -> %d %02x %d\n", x, c.yl, c.yh, c.plane, c.texturemid == TEXTUREMID_PLANE);
             if (c.texturemid == TEXTUREMID_PLANE) {
-                uint8_t *vp = visplane_bit_col + c.yl * SCREENWIDTH / 8;
-                for (int y = c.yl; y <= c.yh; y++) {
-                    *p = color;
-                    p += SCREENWIDTH;
-                    *vp |= visplane_bit_bit;
-                    vp += SCREENWIDTH / 8;
-                }
+                int vp = c.plane;
+                assert(vp < numvisplanes);
                 *last = c.next;
-                // we replace c with two elements in the new free list of plane runs
-                flat_run *fr = (flat_run *) (&c);
-                i *= 2;
-                fr[0].next = (int16_t) (i + 1);
-                fr[1].next = free_list;
-                free_list = i;
+                c.scale = x;
+                c.next = -1;
+                if (visplane_heads[vp] < 0) {
+                    visplane_heads[vp] = i;
+                } else {
+                    render_cols[visplane_tails[vp]].next = i;
+                }
+                visplane_tails[vp] = i;
                 i = *last;
             } else {
                 last = &c.next;
@@ -1147,11 +1272,11 @@ static int16_t predraw_visplanes() {
             }
         }
     }
-    return free_list;
 }
 
 static void re_sort_regular_columns_by_fd_num() {
     memset(fd_heads, -1, sizeof(fd_heads));
+    memset(fd_col_counts, 0, sizeof(fd_col_counts));
     for (int x = 0; x < SCREENWIDTH; x++) {
         int16_t i = column_heads[x];
         while (i >= 0) {
@@ -1161,6 +1286,7 @@ static void re_sort_regular_columns_by_fd_num() {
             // link is index with top bit set if x >= 256... note -1 would conflict with i == 0x7fff, x>=256
             // which we don't care about because i would never be that high
             fd_heads[c.fd_num] = (x >> 8) ? (i | 0x8000) : i;
+            fd_col_counts[c.fd_num]++;
             // loop over old list
             i = c.next;
             // replace fd_num with 8 low bits of x
@@ -1169,6 +1295,20 @@ static void re_sort_regular_columns_by_fd_num() {
             c.next = fd_next;
         }
     }
+    // the cost of a frame drawable is roughly its column count, so handing out the biggest first (insertion sort, as
+    // there are rarely more than a few dozen) keeps the two cores finishing close together
+    fd_queue_size = 0;
+    for (int fd_num = 0; fd_num < num_framedrawables; fd_num++) {
+        if (fd_heads[fd_num] != -1 && framedrawables[fd_num].real_id) {
+            int q = fd_queue_size++;
+            while (q > 0 && fd_col_counts[fd_queue[q - 1]] < fd_col_counts[fd_num]) {
+                fd_queue[q] = fd_queue[q - 1];
+                q--;
+            }
+            fd_queue[q] = fd_num;
+        }
+    }
+    fd_queue_next = 0;
 }
 
 static void clip_columns(int yl, int yh) {
@@ -1198,9 +1338,32 @@ static int translate_picnum(int picnum) {
     return picnum;
 }
 
+static int find_cached_flat(int picnum) {
+    for (int slot = 0; slot < cached_flat_slots; slot++) {
+        if (cached_flat_picnum[slot] == picnum) return slot;
+    }
+    return -1;
+}
+
+static void touch_cached_flat(int slot) {
+    cached_flat_last_use[slot] = ++flat_use_clock;
+}
+
+// an empty slot if there is one, otherwise the least recently used
+static int lru_flat_slot() {
+    assert(cached_flat_slots);
+    int lru = 0;
+    for (int slot = 0; slot < cached_flat_slots; slot++) {
+        if (cached_flat_picnum[slot] == 0xff) return slot;
+        if ((int16_t)(cached_flat_last_use[slot] - cached_flat_last_use[lru]) < 0) lru = slot;
+    }
+    return lru;
+}
+
 static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
     uint8_t *flat_data = cached_flat0 - cache_slot * 4096;
     DEBUG_PINS_SET(flat_decode, 1);
+    PD_PROFILE_COUNT(PD_PROF_FLATS_DECODED, 1);
     uint16_t *pos = flat_decoder_buf;
     uint pos_size = count_of(flat_decoder_buf);
     uint16_t *rp_decoder = flat_decoder_buf;
@@ -1215,25 +1378,24 @@ static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
     th_bit_input_init(&bi, (const uint8_t *) sourcez);
 #endif
     wait_for_input(512); // guess
-    if (th_bit(&bi)) {
-        pos = th_read_simple_decoder(&bi, pos, pos_size, flat_decoder_tmp, count_of(flat_decoder_tmp));
-    } else {
-        pos = read_raw_pixels_decoder(&bi, pos, pos_size, flat_decoder_tmp, count_of(flat_decoder_tmp));
-    }
-    assert(pos < flat_decoder_buf + count_of(flat_decoder_buf));
-    th_make_prefix_length_table(rp_decoder, flat_decoder_tmp);
-    wait_for_input(100000);
-    bool have_same = th_bit(&bi);
-    if (!have_same) {
-        uint8_t *p = flat_data;
-        for (int y = 0; y < 4096; y++) {
-            *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+    if (*lump_info(firstflat + picnum) & WHD_LUMP_FLAT_RANS) {
+        static_assert(sizeof(flat_decoder_buf) >= TR_SYMS_SIZE * sizeof(uint32_t), "");
+        static_assert(sizeof(flat_decoder_tmp) >= TR_SCALE, "");
+        const uint32_t *syms = (const uint32_t *) flat_decoder_buf;
+        tr_read_decoder(&bi, flat_decoder_tmp, (uint32_t *) flat_decoder_buf);
+        // the copied columns come first, as the pixels are in a separate byte stream
+        uint8_t same[64];
+        bool have_same = th_bit(&bi);
+        for (int x = 0; x < 64; x++) {
+            same[x] = have_same && th_bit(&bi) ? th_read_bits(&bi, bitcount8(x)) + 1 : 0;
         }
-    } else {
+        wait_for_input(100000);
+        tr_input ri;
+        tr_input_init(&ri, th_bit_input_align(&bi));
         for (int x = 0; x < 64; x++) {
             uint8_t *p = &flat_data[x * 64];
-            if (th_bit(&bi)) {
-                uint xf = th_read_bits(&bi, bitcount8(x));
+            if (same[x]) {
+                uint xf = same[x] - 1;
                 assert(xf < (uint) x);
                 uint32_t *a = (uint32_t *) p;
                 uint32_t *b = a + 16 * (int) (xf - x);
@@ -1242,18 +1404,281 @@ static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
                 }
             } else {
                 for (int y = 0; y < 64; y++) {
-                    *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+                    *p++ = tr_decode(flat_decoder_tmp, syms, &ri);
                 }
             }
+        }
+    } else {
+        if (th_bit(&bi)) {
+            pos = th_read_simple_decoder(&bi, pos, pos_size, flat_decoder_tmp, count_of(flat_decoder_tmp));
+        } else {
+            pos = read_raw_pixels_decoder(&bi, pos, pos_size, flat_decoder_tmp, count_of(flat_decoder_tmp));
+        }
+        assert(pos < flat_decoder_buf + count_of(flat_decoder_buf));
+        th_make_prefix_length_table(rp_decoder, flat_decoder_tmp);
+        wait_for_input(100000);
+        bool have_same = th_bit(&bi);
+        if (!have_same) {
+            uint8_t *p = flat_data;
+            for (int y = 0; y < 4096; y++) {
+                *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+            }
+        } else {
+            for (int x = 0; x < 64; x++) {
+                uint8_t *p = &flat_data[x * 64];
+                if (th_bit(&bi)) {
+                    uint xf = th_read_bits(&bi, bitcount8(x));
+                    assert(xf < (uint) x);
+                    uint32_t *a = (uint32_t *) p;
+                    uint32_t *b = a + 16 * (int) (xf - x);
+                    for (int i = 0; i < 16; i++) {
+                        a[i] = b[i];
+                    }
+                } else {
+                    for (int y = 0; y < 64; y++) {
+                        *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+                    }
+                }
 
+            }
         }
     }
 //                    printf("Pass %d, caching slot %d pic (%d)\n", pass, cache_slot, picnum);
     cached_flat_picnum[cache_slot] = picnum;
+    touch_cached_flat(cache_slot);
     DEBUG_PINS_CLR(flat_decode, 1);
     return flat_data;
 }
 
+#if USE_CORE1_FOR_FLATS
+// the first flat of the sectors bordering the viewer's which isn't cached yet, if any
+static uint8_t pick_prefetch_flat() {
+    sector_t *sec = subsector_sector(R_PointInSubsector(viewx, viewy));
+    for (int i = 0; i < sec->linecount; i++) {
+        sector_t *other = getNextSector(sector_line(sec, i), sec);
+        if (!other) continue;
+        for (int pic : {other->floorpic, other->ceilingpic}) {
+            if (pic == skyflatnum) continue;
+            pic = translate_picnum(pic);
+            if (find_cached_flat(pic) < 0) return pic;
+        }
+    }
+    return 0xff;
+}
+
+// called by core 1 once it has drawn its share of the frame; flat_clock_at_frame_start tells us which slots are
+// in view, and those are never evicted
+static void prefetch_flat(uint16_t flat_clock_at_frame_start) {
+    int picnum = prefetch_flat_picnum;
+    prefetch_flat_picnum = 0xff;
+    if (picnum == 0xff || find_cached_flat(picnum) >= 0) return;
+    int slot = lru_flat_slot();
+    if (cached_flat_picnum[slot] != 0xff &&
+        (int16_t)(cached_flat_last_use[slot] - flat_clock_at_frame_start) > 0) {
+        return;
+    }
+    decode_flat_to_slot(slot, picnum);
+    // until it is actually drawn it should be the first to go
+    cached_flat_last_use[slot] = flat_clock_at_frame_start;
+}
+#endif
+
+// what draw_plane_span needs for one visplane; the row set up is kept for the next span, as spans arrive a row at a
+// time (consecutive rows when a run of rows ends together), and the colormap for as long as the light index is the same
+struct plane_span_setup {
+    const uint8_t *flat_data;
+    fixed_t viewcosangle;
+    fixed_t viewsinangle;
+    fixed_t rel_height;
+#if !NO_USE_ZLIGHT
+    const int8_t *planezlight;
+#else
+    int startmap;
+#endif
+    int y;
+    unsigned light_index;
+    const lighttable_t *colormap;
+    fixed_t xstep;
+    fixed_t ystep;
+    fixed_t xfrac;
+    fixed_t yfrac;
+};
+
+// draw row y of the current visplane from x_start up to (not including) x_end
+static void draw_plane_span(plane_span_setup &ps, int y, int x_start, int x_end) {
+    if (y != ps.y) {
+        // abs rel height?
+        // todo get rid of yslope?
+        fixed_t distance = FastFixedMul(ps.rel_height, yslope[y]);
+        ps.xstep = FastFixedMul(distance, basexscale);
+        ps.ystep = FastFixedMul(distance, baseyscale);
+        // mved into viewcosangle/sinangle
+#if !MERGE_DISTSCALE0_INTO_VIEWCOSSINANGLE
+        const fixed_t distscale0 = 0x00016a75; // todo i guess this is screen size based
+        fixed_t length = FastFixedMul(distance, distscale0);
+        ps.xfrac = viewx + FastFixedMul(ps.viewcosangle, length);
+        ps.yfrac = -viewy - FastFixedMul(ps.viewsinangle, length);
+#else
+        ps.xfrac = viewx + FastFixedMul(ps.viewcosangle, distance);
+        ps.yfrac = -viewy - FastFixedMul(ps.viewsinangle, distance);
+#endif
+        unsigned index = fixedcolormap ? ~1u : distance >> LIGHTZSHIFT;
+        if (index != ps.light_index) {
+            int8_t colormap_index;
+            if (fixedcolormap) {
+                colormap_index = fixedcolormap;
+            } else {
+#if !NO_USE_ZLIGHT
+                if (index >= MAXLIGHTZ)
+                    index = MAXLIGHTZ - 1;
+                colormap_index = ps.planezlight[index];
+#else
+                // NOTE: we assume we have no IRQs on this core using the divider
+                fixed_t scale = hw_divider_s32_quotient_inlined((SCREENWIDTH / 4), (index + 1));
+                //fixed_t scale = (SCREENWIDTH / 4) / (index + 1);
+                int level = ps.startmap - scale;
+
+                if (level < 0)
+                    level = 0;
+
+                if (level >= NUMCOLORMAPS)
+                    level = NUMCOLORMAPS - 1;
+                colormap_index = level;
+#endif
+            }
+            ps.colormap = xcolormaps + colormap_index * 256;
+            ps.light_index = index;
+        }
+        ps.y = y;
+    }
+    const lighttable_t *colormap = ps.colormap;
+    int delta = x_start;
+#if USE_INTERP
+    uint32_t position = ((ps.yfrac << 10) & 0xffff0000)
+                        | ((ps.xfrac >> 6) & 0x0000ffff);
+    uint32_t step = ((ps.ystep << 10) & 0xffff0000)
+                    | ((ps.xstep >> 6) & 0x0000ffff);
+    span_interp->accum[0] = position;
+    span_interp->base[0] = step;
+    span_interp->add_raw[0] = delta * span_interp->base[0];
+#else
+    uint32_t position = ((ps.yfrac << 10) & 0xffff0000)
+                        | ((ps.xfrac >> 6) & 0x0000ffff);
+    uint32_t step = ((ps.ystep << 10) & 0xffff0000)
+                    | ((ps.xstep >> 6) & 0x0000ffff);
+    position += delta * step;
+    const uint8_t *flat_data = ps.flat_data;
+#endif
+#if EL_DIRECT_1B
+    if (render_direct) {
+        uint dm_size, dm_stride;
+        const uint8_t *th = el_dither_rows(render_dm_id, &dm_size, &dm_stride) +
+                            ((y + EL_VIEW_Y) & (dm_size - 1)) * dm_stride;
+        uint th_mask = dm_stride - 1;
+        uint8_t *bits = el_col_bits(x_start) + (y >> 3u);
+        uint bit = 1u << (y & 7u);
+        for (int x = x_start; x < x_end; x++, bits += EL_COL_BYTES) {
+#if USE_INTERP
+            const uint8_t *texel = (const uint8_t *) span_interp->pop[2];
+#else
+            uint32_t spot = ((position >> 4) & 0x0fc0) | (position >> 26);
+            position += step;
+            const uint8_t *texel = &flat_data[spot];
+#endif
+            if (el_lum_palette[colormap[*texel]] >= th[x & th_mask]) *bits |= bit;
+        }
+        return;
+    }
+#endif
+    uint8_t *p = render_frame_buffer + y * SCREENWIDTH + x_start;
+    uint8_t *p_end = p + x_end - x_start;
+    while (p < p_end) {
+#if USE_INTERP
+        const uint8_t *texel = (const uint8_t *) span_interp->pop[2];
+#else
+        // Calculate current texture index in u,v.
+        uint32_t xtemp = (position >> 4) & 0x0fc0;
+        uint32_t ytemp = (position >> 26);
+        uint32_t spot = xtemp | ytemp;
+        position += step;
+        const uint8_t *texel = &flat_data[spot];
+#endif
+        *p++ = colormap[*texel];
+    }
+}
+
+// the next plane column of the same visplane in the same x (predraw_visplanes keeps x in scale), or -1
+static inline int16_t next_plane_column_in_x(int16_t i) {
+    int16_t n = render_cols[i].next;
+    return n >= 0 && render_cols[n].scale == render_cols[i].scale ? n : -1;
+}
+
+// R_MakeSpans, but a column of a visplane may be in several pieces (as sprites in front split it): prev are the plane
+// columns at x - 1 and cur those at x (either may be -1). rows covered by both carry on; a row only in prev ends a span
+// which is drawn now, and a row only in cur starts one
+static void make_plane_spans(plane_span_setup &ps, int x, int16_t prev, int16_t cur) {
+    int y = 0;
+    while (true) {
+        while (prev >= 0 && render_cols[prev].yh < y) prev = next_plane_column_in_x(prev);
+        while (cur >= 0 && render_cols[cur].yh < y) cur = next_plane_column_in_x(cur);
+        if (prev < 0 && cur < 0) break;
+        // rows y to y_end are all the same as far as being in prev or cur goes
+        int y_end = MAIN_VIEWHEIGHT - 1;
+        bool in_prev = false, in_cur = false;
+        if (prev >= 0) {
+            if (render_cols[prev].yl <= y) {
+                in_prev = true;
+                y_end = render_cols[prev].yh;
+            } else {
+                y_end = render_cols[prev].yl - 1;
+            }
+        }
+        if (cur >= 0) {
+            if (render_cols[cur].yl <= y) {
+                in_cur = true;
+                y_end = std::min(y_end, (int)render_cols[cur].yh);
+            } else {
+                y_end = std::min(y_end, render_cols[cur].yl - 1);
+            }
+        }
+        if (in_prev != in_cur) {
+            if (in_prev) {
+                for (int yy = y; yy <= y_end; yy++) {
+                    draw_plane_span(ps, yy, span_x_start[yy], x);
+                }
+            } else {
+                for (int yy = y; yy <= y_end; yy++) {
+                    span_x_start[yy] = x;
+                }
+            }
+        }
+        y = y_end + 1;
+    }
+}
+
+// draw a visplane from its list of plane columns (in x then y order)
+static void draw_visplane_spans(plane_span_setup &ps, int16_t i) {
+    int16_t prev = -1;
+    int prev_x = 0;
+    while (i >= 0) {
+        int x = render_cols[i].scale;
+        if (prev >= 0 && x != prev_x + 1) {
+            // a gap in x, so everything open ends
+            make_plane_spans(ps, prev_x + 1, prev, -1);
+            prev = -1;
+        }
+        make_plane_spans(ps, x, prev, i);
+        prev = i;
+        prev_x = x;
+        do {
+            i = render_cols[i].next;
+        } while (i >= 0 && render_cols[i].scale == (uint)x);
+    }
+    if (prev >= 0) {
+        make_plane_spans(ps, prev_x + 1, prev, -1);
+    }
+}
+
 static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
 //    printf("FRAME %d %d\n", pd_frame, numvisplanes);
     angle_t angle = (viewangle + x_to_viewangle(0)) >> ANGLETOFINESHIFT;
@@ -1264,8 +1689,8 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
     viewcosangle = FixedMul(distscale0, viewcosangle);
     viewsinangle = FixedMul(distscale0, viewsinangle);
 #endif
-    // two passes; first pass we try to reuse flats we have decoded
-    int cache_slot = 0;
+    // two passes; first pass we try to reuse flats we have decoded, so the second only evicts flats not in this frame
+    // (unless there are more flats in view than slots)
     for(int pass=0;pass<2;pass++) {
         for (int i = 0; i < numvisplanes; i++) {
             int picnum = translate_picnum(visplanes[i].picnum);
@@ -1290,22 +1715,14 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
 #else
                 uint8_t *flat_data = nullptr;
                 if (!pass) {
-                    for(cache_slot=0;cache_slot<cached_flat_slots;cache_slot++) {
-                        if (cached_flat_picnum[cache_slot] == picnum) {
-//                            printf("Pass %d, using slot %d pic (%d)\n", pass, cache_slot, picnum);
-                            flat_data = cached_flat0 - cache_slot * 4096;
-                        }
-                    }
-                    if (!flat_data) continue;
+                    int cache_slot = find_cached_flat(picnum);
+                    if (cache_slot < 0) continue;
+//                    printf("Pass %d, using slot %d pic (%d)\n", pass, cache_slot, picnum);
+                    touch_cached_flat(cache_slot);
+                    PD_PROFILE_COUNT(PD_PROF_FLAT_HITS, 1);
+                    flat_data = cached_flat0 - cache_slot * 4096;
                 } else {
-                    cache_slot++;
-                    assert(cached_flat_slots);
-                    if (cache_slot >= cached_flat_slots) {
-                        cache_slot = 0;
-                    }
-                }
-                if (!flat_data) {
-                    flat_data = decode_flat_to_slot(cache_slot, picnum);
+                    flat_data = decode_flat_to_slot(lru_flat_slot(), picnum);
                 }
 #endif
                 DEBUG_PINS_SET(render_flat, 2);
@@ -1316,113 +1733,21 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
                 span_interp->base[2] = (uintptr_t) flat_data;//0x20020000;//(uintptr_t)W_CacheLumpNum(firstflat + pl->picnum, PU_STATIC);
 #endif
                 do {
-                    visplane_t *pl = &visplanes[vp];
-
-                    int last_y = -1;
-                    fixed_t rel_height = abs(pl->height - viewz);
-                    int startmap = ((LIGHTLEVELS - 1 - lightlevel(vp)) * 2) * NUMCOLORMAPS / LIGHTLEVELS;
-//                    int last_x_end = 0;
-
-                    const lighttable_t *colormap;
-                    fixed_t xstep;
-                    fixed_t ystep;
-                    fixed_t xfrac;
-                    fixed_t yfrac;
-#if !USE_INTERP
-                    uint32_t step;
-                    uint32_t position;
-#endif
-                    for (int16_t fr = visplane_heads[vp]; fr != -1; fr = flat_runs[fr].next) {
-                        int delta;
-                        if (flat_runs[fr].y != last_y) {
-                            // abs rel height?
-                            // todo get rid of yslope?
-                            fixed_t distance = FastFixedMul(rel_height, yslope[flat_runs[fr].y]);
-                            xstep = FastFixedMul(distance, basexscale);
-                            ystep = FastFixedMul(distance, baseyscale);
-                            // mved into viewcosangle/sinangle
-#if !MERGE_DISTSCALE0_INTO_VIEWCOSSINANGLE
-                            const fixed_t distscale0 = 0x00016a75; // todo i guess this is screen size based
-                            fixed_t length = FastFixedMul(distance, distscale0);
-                            xfrac = viewx + FastFixedMul(viewcosangle, length);
-                            yfrac = -viewy - FastFixedMul(viewsinangle, length);
-#else
-                            xfrac = viewx + FastFixedMul(viewcosangle, distance);
-                            yfrac = -viewy - FastFixedMul(viewsinangle, distance);
-#endif
-                            int8_t colormap_index;
-                            if (fixedcolormap) {
-                                colormap_index = fixedcolormap;
-                            } else {
-                                unsigned index = distance >> LIGHTZSHIFT;
+                    if (visplane_heads[vp] != -1) {
+                        visplane_t *pl = &visplanes[vp];
+                        plane_span_setup ps;
+                        ps.flat_data = flat_data;
+                        ps.viewcosangle = viewcosangle;
+                        ps.viewsinangle = viewsinangle;
+                        ps.rel_height = abs(pl->height - viewz);
 #if !NO_USE_ZLIGHT
-                                if (index >= MAXLIGHTZ)
-                                    index = MAXLIGHTZ - 1;
-                                const int8_t *planezlight = &grs.zlight[pl->lightlevel * MAXLIGHTZ];
-                                colormap_index = planezlight[index];
-#else
-                                // NOTE: we assume we have no IRQs on this core using the divider
-                                fixed_t scale = hw_divider_s32_quotient_inlined((SCREENWIDTH / 4), (index + 1));
-                                //fixed_t scale = (SCREENWIDTH / 4) / (index + 1);
-                                int level = startmap - scale;
-
-                                if (level < 0)
-                                    level = 0;
-
-                                if (level >= NUMCOLORMAPS)
-                                    level = NUMCOLORMAPS - 1;
-                                colormap_index = level;
-#endif
-                            }
-                            colormap = xcolormaps + colormap_index * 256;
-                            delta = flat_runs[fr].x_start;
-                            last_y = flat_runs[fr].y;
-                        } else {
-                            // we are in reverse x order
-                            delta = flat_runs[fr].x_start;// - last_x_end;
-                        }
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-
-#if USE_INTERP
-                        uint32_t position = ((yfrac << 10) & 0xffff0000)
-                                            | ((xfrac >> 6) & 0x0000ffff);
-                        uint32_t step = ((ystep << 10) & 0xffff0000)
-                                        | ((xstep >> 6) & 0x0000ffff);
-                        span_interp->accum[0] = position;
-                        span_interp->base[0] = step;
-#else
-                        position = ((yfrac << 10) & 0xffff0000)
-                                | ((xfrac >> 6) & 0x0000ffff);
-                        step = ((ystep << 10) & 0xffff0000)
-                                | ((xstep >> 6) & 0x0000ffff);
-#endif
-#pragma GCC diagnostic pop
-#if USE_INTERP
-                        span_interp->add_raw[0] = delta * span_interp->base[0];
+                        ps.planezlight = &grs.zlight[pl->lightlevel * MAXLIGHTZ];
 #else
-                        position += delta * step;
+                        ps.startmap = ((LIGHTLEVELS - 1 - lightlevel(vp)) * 2) * NUMCOLORMAPS / LIGHTLEVELS;
 #endif
-                        //            printf("partial\n");
-                        uint8_t *p = render_frame_buffer + flat_runs[fr].y * SCREENWIDTH + flat_runs[fr].x_start;
-                        uint8_t *p_end = p + flat_runs[fr].x_end - flat_runs[fr].x_start;
-                        while (p < p_end) {
-#if USE_INTERP
-                            const uint8_t *texel = (const uint8_t *) span_interp->pop[2];
-#else
-                            // Calculate current texture index in u,v.
-                            uint32_t xtemp = (position >> 4) & 0x0fc0;
-                            uint32_t ytemp = (position >> 26);
-                            uint32_t spot = xtemp | ytemp;
-                            position += step;
-                            const uint8_t *texel = &flat_data[spot];
-#endif
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-                            *p++ = colormap[*texel];
-#pragma GCC diagnostic pop
-                        }
-//                        last_x_end = flat_runs[fr].x_end;
+                        ps.y = -1;
+                        ps.light_index = ~0u;
+                        draw_visplane_spans(ps, visplane_heads[vp]);
                     }
                     vp = flatnum_next[vp];
                 } while (vp != -1);
@@ -1433,11 +1758,10 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
     }
 }
 
-static void draw_visplanes(int16_t fr_list) {
+static void draw_visplanes() {
     if (!lastvisplane) return;
     int numvisplanes = lastvisplane - visplanes;
 
-    memset(visplane_heads, -1, numvisplanes * sizeof(visplane_heads[0]));
     memset(flatnum_first, -1, sizeof(flatnum_first));
     memset(flatnum_next, -1,  numvisplanes * sizeof(flatnum_next[0]));
     for (int i = 0; i < numvisplanes; i++) {
@@ -1461,81 +1785,7 @@ static void draw_visplanes(int16_t fr_list) {
     interp_config_set_mask(&c, 0, 5);
     interp_set_config(span_interp, 1, &c);
 #endif
-
-    // first sort by visplane
-    int16_t fr_pos = fr_list;
-    for (int y = 0; y < viewheight; y++) {
-        uint8_t *vp = &visplane_bit[y * (SCREENWIDTH / 8)];
-        uint8_t *vp_end = vp + SCREENWIDTH / 8;
-        uint bit = 0;
-        uint8_t *p0 = &render_frame_buffer[y * SCREENWIDTH];
-        uint8_t *p = p0;
-        while (vp != vp_end) {
-//            printf("y %d, x %d + %d = %02x\n", y, (int)(vp- &visplane_bit[y * (SCREENWIDTH / 8)]), bit, *vp);
-            assert(bit < 8);
-            assert(0 == (*vp & ((1u << (bit)) - 1)));
-            if (!*vp) {
-                vp++;
-                p += 8 - bit;
-                bit = 0;
-                continue;
-            }
-            // new span starts within the 8 pixels
-            while (!(*vp & (1u << bit))) bit++, p++; // todo ctz table?
-//            printf("skipped ot y %d, x %d + %d plane=%d\n", y, (int)(vp- &visplane_bit[y * (SCREENWIDTH / 8)]), bit, *p);
-            assert(bit < 8);
-            assert(*p != 255);
-            uint x_start = p - p0;
-            uint8_t plane_num = *p;
-//            if (plane_num >= numvisplanes) {
-//                printf("WAHAHF x=%d y=%d %d %d *vp %02x bit %d %p\n", x_start, y, plane_num, numvisplanes, *vp, bit, p);
-//            }
-            assert(plane_num < numvisplanes);
-            while (bit < 8 && *p == plane_num && *vp & (1u << bit)) {
-                p++;
-                bit++;
-            }
-            if (bit == 8) {
-                vp++;
-                bit = 0;
-                if (*vp == 255 && *p == plane_num) {
-                    uint fourx = plane_num * 0x1010101;
-                    assert(!(((uintptr_t) p) & 0x3));
-                    while (vp < vp_end && *vp == 255 && ((uint32_t *) p)[0] == fourx && ((uint32_t *) p)[1] == fourx) {
-                        p += 8;
-                        vp++;
-                    }
-                }
-                if (vp < vp_end) {
-                    while (bit < 8 && *p == plane_num && *vp & (1u << bit)) {
-                        p++;
-                        bit++;
-                    }
-                    assert(bit != 8); // should have been handled above by 8x case
-                    *vp &= ~((1u << bit) - 1);
-                }
-            } else {
-                *vp &= ~((1u << bit) - 1);
-            }
-            if (fr_pos == -1) {
-                flush_visplanes(flatnum_next, numvisplanes);
-                memset(visplane_heads, -1, MAXVISPLANES * 2);
-                fr_pos = fr_list;
-                break;
-            }
-            auto &fr = flat_runs[fr_pos];
-            fr.x_start = x_start;
-            fr.x_end = p - p0;
-            fr.y = y;
-            int16_t tmp = fr.next;
-            fr.next = visplane_heads[plane_num];
-            visplane_heads[plane_num] = fr_pos;
-            fr_pos = tmp;
-        }
-    }
-    if (fr_pos != fr_list) {
-        flush_visplanes(flatnum_next, numvisplanes);
-    }
+    flush_visplanes(flatnum_next, numvisplanes);
 }
 
 static inline void col_render(uint8_t *dest, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t* colormap) {
@@ -1588,12 +1838,39 @@ static inline void col_render(uint8_t *dest, uint count, const uint8_t *source,
 #endif
 }
 
-struct patch_hash_entry_header {
-    uint16_t patch_num;
-    int16_t next;
-    uint16_t size:15;
-    uint16_t encoding:1;
-};
+#if EL_DIRECT_1B
+// palette lookup and dither fused into the column loop; the planes are cleared each frame so we only OR in
+static void __not_in_flash_func(col_render_1b)(int x, int yl, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t* colormap) {
+    uint dm_size, dm_stride;
+    const uint8_t *th = el_dither_rows(render_dm_id, &dm_size, &dm_stride) + (x & (dm_stride - 1));
+    const uint8_t *lum = el_lum_palette;
+    uint8_t *dest = el_col_bits(x);
+    uint y = yl;
+    uint32_t bits = 0;
+    do {
+        uint t = th[((y + EL_VIEW_Y) & (dm_size - 1)) * dm_stride];
+        // t - 1 - lum is negative exactly when lum >= t
+        bits |= ((t - 1u - lum[colormap[source[(frac >> FRACBITS) & 127]]]) >> 31u) << (y & 7u);
+        frac += fracstep;
+        if ((y & 7u) == 7u) {
+            dest[y >> 3u] |= bits;
+            bits = 0;
+        }
+        y++;
+    } while (count--);
+    if (bits) dest[(y - 1) >> 3u] |= bits;
+}
+#endif
+
+static inline void col_draw(uint8_t *dest, int x, int yl, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t* colormap) {
+#if EL_DIRECT_1B
+    if (render_direct) {
+        col_render_1b(x, yl, count, source, frac, fracstep, colormap);
+        return;
+    }
+#endif
+    col_render(dest, count, source, frac, fracstep, colormap);
+}
 
 struct patch_decode_info {
     const patch_t *patch;
@@ -1604,96 +1881,61 @@ struct patch_decode_info {
     uint16_t w;
 };
 
-#define PATCH_HASH_ENTRY_HEADER_HWORDS 3
-static_assert(sizeof(struct patch_hash_entry_header)==2 * PATCH_HASH_ENTRY_HEADER_HWORDS, "");
-static inline int patch_hash(int patch_num) {
-    // todo better hash
-    return patch_num & (PATCH_DECODER_HASH_SIZE - 1);
-}
-
-// returns positive for existing slot, inverted for where to put
-static inline int patch_offset_or_inverse_slot(int patch_num) {
-    int slot = patch_hash(patch_num);
-    int offset = patch_hash_offsets[slot];
-    while (offset != -1) {
-        patch_hash_entry_header *header = (patch_hash_entry_header *)(patch_decoder_circular_buf + offset);
-        assert(slot == patch_hash(header->patch_num));
-        if (header->patch_num == patch_num) return offset;
-        offset = header->next;
-    }
-    return ~slot;
-}
-
-static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_pos = 0, int pdi_count = 1) {
+// pin keeps the decoder cached for PATCH_CACHE_PINNED_FRAMES since its last use (core 0 only)
+static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_pos = 0, int pdi_count = 1, bool pin = false) {
     auto& pdi = pdis[pdi_pos];
     pdi.patch = (patch_t *) W_CacheLumpNum(patch_num, PU_CACHE);
     bool simple_path = get_core_num();
-    int offset_or_inverse_slot = patch_offset_or_inverse_slot(patch_num);
+    // core 1 doesn't use the cache, so mustn't walk it while core 0 may be changing it
+    int offset_or_inverse_slot = simple_path ? -1 : patch_offset_or_inverse_slot(patch_num);
     uint data_index = 3 + patch_has_extra(pdi.patch);
     if (!simple_path && offset_or_inverse_slot >= 0) {
+        PD_PROFILE_COUNT(PD_PROF_DECODER_HITS, 1);
         data_index += ((uint8_t *) pdi.patch)[data_index * 2]; // skip over decoder metadata
         patch_hash_entry_header *header = (patch_hash_entry_header *)(patch_decoder_circular_buf + offset_or_inverse_slot);
         assert(header->patch_num == patch_num);
-        pdi.decoder = patch_decoder_circular_buf + offset_or_inverse_slot + PATCH_HASH_ENTRY_HEADER_HWORDS;
+        touch_patch_decoder(offset_or_inverse_slot, pin);
+        pdi.decoder = patch_decoder_circular_buf + offset_or_inverse_slot + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS;
         pdi.header = *header;
 #if DECODER_DECODER_BUFFERS
         printf("found patch=%d at offset %d\n", patch_num, offset_or_inverse_slot);
 #endif
     } else {
         DEBUG_PINS_SET(patch_decode, 1);
+        PD_PROFILE_COUNT(PD_PROF_DECODER_MISSES, 1);
         int space_needed = patch_decoder_size_needed(pdi.patch) + PATCH_HASH_ENTRY_HEADER_HWORDS;
+        if (!simple_path) space_needed += PATCH_CACHE_USE_HWORDS;
 #if DEBUG_DECODER_BUFFERS
         printf("Need slot of size %d\n", space_needed);
 #endif
         uint16_t *pos;
         patch_hash_entry_header *header;
         if (simple_path) {
-            pos = flat_decoder_buf;
+            assert(space_needed <= CORE1_DECODER_HWORDS);
+            pos = (uint16_t *)(core1_scratch + CORE1_DECODERS_OFFSET) + pdi_pos * CORE1_DECODER_HWORDS;
             header = (patch_hash_entry_header*)pos;
         } else {
-            while (patch_decoder_circular_buf_write_pos >=
-                   patch_decoder_circular_buf_write_limit - space_needed) {
-                if (patch_decoder_circular_buf_write_limit == PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
-                    // we have wrapped
-                    patch_decoder_circular_buf_write_pos = patch_decoder_circular_buf_write_limit = 0;
-                } else {
-                    // we need to advance
-                    patch_hash_entry_header *header = (patch_hash_entry_header *) (patch_decoder_circular_buf +
-                                                                                   patch_decoder_circular_buf_write_limit);
-                    if (header->patch_num) {
-                        // free the patch we now encounter
-#if DEBUG_DECODER_BUFFERS
-                        printf("Freeing slot (%d) at %08x->%08x\n", header->patch_num, patch_decoder_circular_buf_write_limit, patch_decoder_circular_buf_write_limit + header->size);
-#endif
-                        uint slot = patch_hash(header->patch_num);
-                        int16_t *last = &patch_hash_offsets[slot];
-                        while (*last != -1 && *last != patch_decoder_circular_buf_write_limit) {
-                            last = &((patch_hash_entry_header *) (patch_decoder_circular_buf + *last))->next;
-                        }
-                        assert(*last != -1);
-                        *last = ((patch_hash_entry_header *) (patch_decoder_circular_buf + *last))->next;
-                        for (int p = 0; p < pdi_count; p++) {
-                            if (pdis[p].header.patch_num == header->patch_num) {
-                                pdis[p].decoder = nullptr;
-                            }
-                        }
-                        patch_decoder_circular_buf_write_limit += header->size;
-                    } else {
-                        // we've reached the end of what was there
-                        patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+            patch_cache_make_room(space_needed, [&](int patch, int offset) {
+                for (int p = 0; p < pdi_count; p++) {
+                    if (pdis[p].header.patch_num == patch && pdis[p].decoder) {
+                        pdis[p].decoder = patch_decoder_circular_buf + offset + PATCH_HASH_ENTRY_HEADER_HWORDS +
+                                          PATCH_CACHE_USE_HWORDS;
                     }
                 }
-            }
-            pos = patch_decoder_circular_buf + patch_decoder_circular_buf_write_pos;
-            uint slot = ~offset_or_inverse_slot;
+            }, [&](int patch) {
+                for (int p = 0; p < pdi_count; p++) {
+                    if (pdis[p].header.patch_num == patch) {
+                        pdis[p].decoder = nullptr;
+                    }
+                }
+            });
 #if DEBUG_DECODER_BUFFERS
-            printf("Allocate slot %d (%d) at %08x limit %08x\n", slot, patch_num, patch_decoder_circular_buf_write_pos, patch_decoder_circular_buf_write_limit);
+            printf("Allocate (%d) at %08x limit %08x\n", patch_num, patch_decoder_circular_buf_write_pos, patch_decoder_circular_buf_write_limit);
 #endif
-            uint slot_offset = patch_decoder_circular_buf_write_pos;
-            header = (patch_hash_entry_header *)(patch_decoder_circular_buf + slot_offset);
-            assert( slot >=0 && slot < PATCH_DECODER_HASH_SIZE);
-            header->next = patch_hash_offsets[slot];
-            patch_hash_offsets[slot] = slot_offset;
+            int slot_offset = patch_cache_insert(patch_num, offset_or_inverse_slot, pin);
+            pos = patch_decoder_circular_buf + slot_offset;
+            header = (patch_hash_entry_header *)pos;
+            pos += PATCH_CACHE_USE_HWORDS;
         }
         header->patch_num = patch_num;
         pos += PATCH_HASH_ENTRY_HEADER_HWORDS;
@@ -1749,12 +1991,11 @@ static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_po
                 }
             }
             assert(pos <= patch_decoder_circular_buf + PATCH_DECODER_CIRCULAR_BUFFER_SIZE - 1);
-            header->size = pos + PATCH_HASH_ENTRY_HEADER_HWORDS - pdi.decoder;
+            patch_cache_commit((uint16_t *)header - patch_decoder_circular_buf,
+                               pos + PATCH_HASH_ENTRY_HEADER_HWORDS + PATCH_CACHE_USE_HWORDS - pdi.decoder);
 #if !PICO_ON_DEVICE
             patch_decoder_size.record(header->size);
 #endif
-            patch_decoder_circular_buf_write_pos += header->size;
-            patch_decoder_circular_buf[patch_decoder_circular_buf_write_pos] = 0; // we need a zero patch number to follow
         }
         pdi.header = *header;
         DEBUG_PINS_CLR(patch_decode, 1);
@@ -1783,14 +2024,124 @@ const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder)
 }
 
 const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder, int pos) {
-    if (patch_num == patch_decoder_tmp_table_patch_numbers[pos]) return patch_decoder_tmp + pos * 256;
+    uint16_t *table_patch_numbers = patch_decoder_tmp_table_patch_numbers;
+    uint8_t *tables = patch_decoder_tmp;
+    if (get_core_num()) {
+        table_patch_numbers = core1_decoder_table_patch_numbers;
+        tables = core1_scratch + CORE1_DECODER_TABLES_OFFSET;
+    }
+    if (patch_num == table_patch_numbers[pos]) return tables + pos * 256;
 #if DEBUG_DECODER
     printf("Get decoder %d table pos %d\n", patch_num, pos);
 #endif
-    th_make_prefix_length_table(decoder, patch_decoder_tmp + pos * 256); // the table is large and quick to generate, so we don't cache
-    patch_decoder_tmp_table_patch_numbers[pos] = patch_num;
-    return patch_decoder_tmp + pos * 256;
+    th_make_prefix_length_table(decoder, tables + pos * 256); // the table is large and quick to generate, so we don't cache
+    table_patch_numbers[pos] = patch_num;
+    return tables + pos * 256;
+}
+
+// decode rows 0 to last of a patch column into pixels
+static inline void decode_patch_column(const patch_decode_info &pdi, const uint8_t *patch_decoder_table, int col, uint8_t *pixels, int last) {
+    uint16_t col_offset = pdi.col_offsets[col];
+    if (0xff == (col_offset >> 8)) {
+        assert((col_offset&0xff)<pdi.w);
+        col_offset = pdi.col_offsets[col_offset & 0xff];
+    }
+    th_bit_input bi;
+    if (patch_byte_addressed(pdi.patch)) {
+        th_bit_input_init(&bi, pdi.patch + pdi.data_index + col_offset); // todo read off end potential
+    } else {
+        th_bit_input_init_bit_offset(&bi, pdi.patch + pdi.data_index, col_offset); // todo read off end potential
+    }
+    if (!pdi.header.encoding) {
+        for (int j = 0; j <= last; j++) {
+            pixels[j] = th_decode_table_special(pdi.decoder, patch_decoder_table, &bi);
+        }
+    } else {
+        for (int j = 0; j <= last; j++) {
+//            uint16_t p = th_decode_16(rp_decoder, &bi);
+            uint16_t p = th_decode_table_special_16(pdi.decoder, patch_decoder_table, &bi);
+            if (p < 256) {
+                pixels[j] = p;
+            } else {
+                int prev = j - 1;
+                assert(prev>=0);
+                assert(1 == p >> 8);
+                p &= 0xff;
+                assert(p<7);
+                pixels[j] = pixels[prev] + p - 3;
+            }
+        }
+    }
+}
+
+#if PD_SKY_STRIP
+// the sky patch decoded once per level, 4 bits per pixel (low nibble first) indexing the 16 colors in
+// sky_strip_palette. the colors are picked by luminance, as that is all the panel shows: the sky's colors are split
+// into 16 groups of roughly equal pixel count in luminance order, and each group drawn as its most common color (so
+// a sky of 16 colors or fewer is exact)
+#define SKY_STRIP_WIDTH 256
+#define SKY_STRIP_HEIGHT 128
+static uint8_t __aligned(4) sky_strip[SKY_STRIP_WIDTH * SKY_STRIP_HEIGHT / 2];
+static uint8_t sky_strip_palette[16];
+
+static void build_sky_strip() {
+    sky_strip_patch = -1;
+    sky_strip_checked = skytexture_patch;
+    patch_decode_info pdi;
+    get_patch_decoder(skytexture_patch, &pdi, 0, 1, true);
+    int h = patch_height(pdi.patch);
+    // wider or taller (pwad) skies are drawn by the generic path; sky_strip_checked stops us looking again every frame
+    if (pdi.w > SKY_STRIP_WIDTH || h > SKY_STRIP_HEIGHT) return;
+    const uint8_t *patch_decoder_table = get_patch_decoder_table(skytexture_patch, pdi.decoder);
+    uint8_t pixels[SKY_STRIP_HEIGHT];
+    uint16_t counts[256];
+    memset(counts, 0, sizeof(counts));
+    for (int col = 0; col < pdi.w; col++) {
+        decode_patch_column(pdi, patch_decoder_table, col, pixels, h - 1);
+        for (int j = 0; j < h; j++) counts[pixels[j]]++;
+    }
+    // used colors in luminance order (insertion sort; this is once per level)
+    uint8_t order[256];
+    int used = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!counts[c]) continue;
+        int i = used++;
+        while (i > 0 && el_lum_palette[order[i - 1]] > el_lum_palette[c]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = c;
+    }
+    uint8_t nibble[256];
+    uint total = pdi.w * h;
+    uint so_far = 0;
+    int group = 0;
+    uint best = 0;
+    for (int i = 0; i < used; i++) {
+        int c = order[i];
+        // a new group once this one has its share of the pixels, leaving a group for each remaining color if need be
+        if (i && (so_far * 16 >= (group + 1) * total || used - i <= 15 - group) && group < 15) {
+            group++;
+            best = 0;
+        }
+        nibble[c] = group;
+        if (counts[c] > best) {
+            best = counts[c];
+            sky_strip_palette[group] = c;
+        }
+        so_far += counts[c];
+    }
+    memset(sky_strip, 0, sizeof(sky_strip));
+    for (int col = 0; col < pdi.w; col++) {
+        decode_patch_column(pdi, patch_decoder_table, col, pixels, h - 1);
+        uint8_t *dest = sky_strip + col * (SKY_STRIP_HEIGHT / 2);
+        for (int j = 0; j < h; j++) {
+            dest[j >> 1] |= nibble[pixels[j]] << ((j & 1) * 4);
+        }
+    }
+    sky_strip_patch = skytexture_patch;
 }
+#endif
 
 static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads, uint8_t *col_height, int translated) {
     // fix up the sky scale (we had to preserve the original scale for column clipping/sorting)
@@ -1803,7 +2154,18 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
         }
     }
     patch_decode_info pdi;
-    get_patch_decoder(patch_num, &pdi);
+#if PD_SKY_STRIP
+    bool from_sky_strip = patch_num == sky_strip_patch;
+    if (from_sky_strip) {
+        pdi.patch = (patch_t *) W_CacheLumpNum(patch_num, PU_CACHE);
+        pdi.w = patch_width(pdi.patch);
+    } else
+#endif
+    {
+        // the player's weapon and the sky are drawn every frame, so keep their decoders even when the frame is busy
+        bool pin = patch_num == skytexture_patch || column_is_psprite(render_cols[patch_head & 0x7fffu]);
+        get_patch_decoder(patch_num, &pdi, 0, 1, pin);
+    }
     assert(pdi.w <= WHD_PATCH_MAX_WIDTH);
     // moved these to the caller because not enough stack on core 1, core 0 can use a fixed 256 size since it seems to have enough stack (it isn't calling audio from here)
 //    int16_t col_heads[pdi.w];
@@ -1840,8 +2202,11 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
         if (tmp == -1 || end > col_height[col]) col_height[col] = (uint8_t)end;
     } while (i != -1);
 
-    const uint16_t *col_offsets = pdi.col_offsets;
-    const uint8_t *patch_decoder_table = get_patch_decoder_table(patch_num, pdi.decoder);
+    const uint8_t *patch_decoder_table = nullptr;
+#if PD_SKY_STRIP
+    if (!from_sky_strip)
+#endif
+    patch_decoder_table = get_patch_decoder_table(patch_num, pdi.decoder);
     for(int col = 0; col < pdi.w; col++) {
         i = col_heads[col];
         if (!(col & 63) && get_core_num()) {
@@ -1850,38 +2215,18 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
             restart_song_state &= ~1;
         }
         if (i != -1) {
-            uint16_t col_offset = col_offsets[col];
-            if (0xff == (col_offset >> 8)) {
-                assert((col_offset&0xff)<pdi.w);
-                col_offset = col_offsets[col_offset & 0xff];
-            }
             uint8_t pixels[257];
-            th_bit_input bi;
-            if (patch_byte_addressed(pdi.patch)) {
-                th_bit_input_init(&bi, pdi.patch + pdi.data_index + col_offset); // todo read off end potential
-            } else {
-                th_bit_input_init_bit_offset(&bi, pdi.patch + pdi.data_index, col_offset); // todo read off end potential
-            }
-            if (!pdi.header.encoding) {
-                for (int j = 0; j <= col_height[col]; j++) {
-                    pixels[j] = th_decode_table_special(pdi.decoder, patch_decoder_table, &bi);
-                }
-            } else {
-                for (int j = 0; j <= col_height[col]; j++) {
-//                    uint16_t p = th_decode_16(rp_decoder, &bi);
-                    uint16_t p = th_decode_table_special_16(pdi.decoder, patch_decoder_table, &bi);
-                    if (p < 256) {
-                        pixels[j] = p;
-                    } else {
-                        int prev = j - 1;
-                        assert(prev>=0);
-                        assert(1 == p >> 8);
-                        p &= 0xff;
-                        assert(p<7);
-                        pixels[j] = pixels[prev] + p - 3;
-                    }
+#if PD_SKY_STRIP
+            if (from_sky_strip) {
+                const uint8_t *src = sky_strip + col * (SKY_STRIP_HEIGHT / 2);
+                for (int j = 0; j <= col_height[col]; j += 2) {
+                    uint8_t b = *src++;
+                    pixels[j] = sky_strip_palette[b & 0xf];
+                    pixels[j + 1] = sky_strip_palette[b >> 4];
                 }
-            }
+            } else
+#endif
+            decode_patch_column(pdi, patch_decoder_table, col, pixels, col_height[col]);
 #if USE_PICO_NET
             // bit of a waste of time mostly. would be cheaper to change the decoder tables, but then again
             // that is a lot of dealing with polluting caches, so unless this causes marked slowdown, go with this
@@ -1911,7 +2256,7 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
                     fixed_t fracstep = DDA_UP_SHIFT(c.scale);
                     if (!fracstep) fracstep = 0x10000;
                     fixed_t frac = UP_SHIFT(c.texturemid) + (c.yl - centery) * fracstep;
-                    col_render(p, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
+                    col_draw(p, c.x + ((i & 0x8000u) >> 7u), c.yl, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
                     i = c.next;
                 } while (i != -1);
             } else {
@@ -1937,7 +2282,7 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
 //                            p += SCREENWIDTH;
 //                        }
 //                    }
-                    col_render(p, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
+                    col_draw(p, c.x + ((i & 0x8000u) >> 7u), c.yl, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
                     i = c.next;
                 } while (i != -1);
             }
@@ -1945,10 +2290,11 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
     }
 }
 
-static void draw_composite_columns(int texture_num, int tex_head) {
+// col_heads is the WHD_PATCH_MAX_WIDTH * 3 byte buffer from draw_regular_columns (core 1 has very little stack)
+static void draw_composite_columns(int texture_num, int tex_head, int16_t *col_heads) {
     uint w = texture_width(texture_num);
-    int16_t col_heads[w];
-    memset(col_heads, -1, sizeof(col_heads));
+    assert(w * sizeof(int16_t) <= WHD_PATCH_MAX_WIDTH * 3);
+    memset(col_heads, -1, w * sizeof(int16_t));
     int i = tex_head;
     assert(i != -1);
     // todo not sure this is beneficial
@@ -2221,7 +2567,7 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                                 fixed_t fracstep = DDA_UP_SHIFT(c.scale);
                                 if (!fracstep) fracstep = 0x10000;
                                 fixed_t frac = UP_SHIFT(c.texturemid) + (c.yl - centery) * fracstep;
-                                col_render(p, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
+                                col_draw(p, c.x + ((i & 0x8000u) >> 7u), c.yl, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
                                 i = c.next;
                             } while (i != -1);
                         } else {
@@ -2236,7 +2582,7 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                                 fixed_t fracstep = DDA_UP_SHIFT(c.scale);
                                 if (!fracstep) fracstep = 0x10000;
                                 fixed_t frac = UP_SHIFT(c.texturemid) + (c.yl - centery) * fracstep;
-                                col_render(p, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
+                                col_draw(p, c.x + ((i & 0x8000u) >> 7u), c.yl, c.yh - c.yl, pixels, frac, fracstep, dc_colormap);
                                 i = c.next;
                             } while (i != -1);
                         }
@@ -2293,59 +2639,64 @@ static void draw_composite_columns(int texture_num, int tex_head) {
     }
 }
 
+// claim the next frame drawable to draw, or -1 when there are none left
+static int claim_framedrawable(spin_lock_t *lock) {
+    // the M0+ has no exclusive load/store, so claims go through the hardware spin lock
+    uint32_t save = spin_lock_blocking(lock);
+    int q = fd_queue_next;
+    if (q < fd_queue_size) fd_queue_next = q + 1;
+    spin_unlock(lock, save);
+    return q < fd_queue_size ? fd_queue[q] : -1;
+}
+
 // noinline as it uses alloca
 static void __noinline draw_regular_columns(int core) {
-    if (!core) {
-        // on core 0 draw the textures first
-        for(int fd_num=0; fd_num < num_framedrawables; fd_num++) {
-            int i = fd_heads[fd_num];
-            if (i != -1 && framedrawables[fd_num].real_id > 0) {
-                DEBUG_PINS_SET(render_thing, 1<<core);
-                draw_composite_columns(framedrawables[fd_num].real_id, i);
-                DEBUG_PINS_CLR(render_thing, 1<<core);
-            }
-        }
-    }
     spin_lock_t *lock = spin_lock_instance(RENDER_SPIN_LOCK);
     uint8_t *buffer;
     if (core) {
-        static_assert(sizeof(visplane_bit) >= WHD_PATCH_MAX_WIDTH, "");
-        // visplane_bit is no longer used on core 1 as we've already drawn
-        buffer = visplane_bit;
+        static_assert(sizeof(core1_scratch) >= WHD_PATCH_MAX_WIDTH, "");
+        // core1_scratch is no longer used for spans as we've already drawn the flats
+        buffer = core1_scratch;
+        // the flats have overwritten any decoder tables from the last frame
+        memset(core1_decoder_table_patch_numbers, 0, sizeof(core1_decoder_table_patch_numbers));
     } else {
         // on core 0 we can use the stack
         buffer = (uint8_t *)__builtin_alloca(WHD_PATCH_MAX_WIDTH * 3);
     }
-    for(int fd_num=0; fd_num < num_framedrawables; fd_num++) {
+    // both cores draw both composite textures and single patches, biggest first
+    for (int fd_num; (fd_num = claim_framedrawable(lock)) >= 0; ) {
         int i = fd_heads[fd_num];
-        if (i != -1) {
-            uint32_t save = spin_lock_blocking(lock);
-            int id = framedrawables[fd_num].real_id;
-            if (id < 0) {
-                framedrawables[fd_num].real_id = 0; // mark as done
-            }
-            spin_unlock(lock, save);
-            if (id < 0) {
-                DEBUG_PINS_SET(render_thing, 1<<core);
-                int translated = 0;
-                if (fd_num == translated_fds[0]) {
-                    translated = 1;
-                } else if (fd_num == translated_fds[1]) {
-                    translated = 2;
-                } else if (fd_num == translated_fds[2]) {
-                    translated = 3;
-                }
-                draw_patch_columns(-id, i, (int16_t*)buffer, buffer + WHD_PATCH_MAX_WIDTH * 2, translated);
-                DEBUG_PINS_CLR(render_thing, 1<<core);
+        int id = framedrawables[fd_num].real_id;
+        DEBUG_PINS_SET(render_thing, 1<<core);
+        PD_PROFILE_COUNT(PD_PROF_FRAMEDRAWABLES, 1);
+        if (id > 0) {
+            draw_composite_columns(id, i, (int16_t *)buffer);
+        } else {
+            int translated = 0;
+            if (fd_num == translated_fds[0]) {
+                translated = 1;
+            } else if (fd_num == translated_fds[1]) {
+                translated = 2;
+            } else if (fd_num == translated_fds[2]) {
+                translated = 3;
             }
+            draw_patch_columns(-id, i, (int16_t*)buffer, buffer + WHD_PATCH_MAX_WIDTH * 2, translated);
         }
+        DEBUG_PINS_CLR(render_thing, 1<<core);
     }
 }
 
-int8_t fuzzpos;
-
-static void draw_fuzz_columns() {
-    for (int x = 0; x < SCREENWIDTH; x++) {
+// fuzz columns are handed out a strip of FUZZ_STRIP_WIDTH screen columns at a time to whichever core asks, as they only
+// read back pixels from their own x
+#define FUZZ_STRIP_WIDTH 32
+static_assert(SCREENWIDTH % FUZZ_STRIP_WIDTH == 0, "");
+static uint8_t fuzz_strip_next;
+// so the pattern moves from frame to frame (each strip starts at a fixed offset from this)
+static uint8_t fuzz_frame_pos;
+
+static void draw_fuzz_columns(int x0, int x1) {
+    int fuzzpos = (fuzz_frame_pos + x0) % FUZZTABLE;
+    for (int x = x0; x < x1; x++) {
         const lighttable_t *darken_map = xcolormaps + 256 * 6;
         int16_t i = fuzzy_column_heads[x];
         while (i >= 0) {
@@ -2374,7 +2725,68 @@ static void draw_fuzz_columns() {
     }
 }
 
+#if EL_DIRECT_1B
+// there is no colour left to darken, so take the neighbouring pixel and drop it where the dither threshold is high.
+// the result goes in core 0's plane, so the bit must be cleared in core 1's
+static void draw_fuzz_columns_1b(int x0, int x1) {
+    uint8_t *plane0 = el_col_planes[render_frame_index][0];
+    uint8_t *plane1 = el_col_planes[render_frame_index][1];
+    uint dm_size, dm_stride;
+    const uint8_t *dm = el_dither_rows(render_dm_id, &dm_size, &dm_stride);
+    int fuzzpos = (fuzz_frame_pos + x0) % FUZZTABLE;
+    for (int x = x0; x < x1; x++) {
+        int16_t i = fuzzy_column_heads[x];
+        uint8_t *col0 = plane0 + x * EL_COL_BYTES;
+        uint8_t *col1 = plane1 + x * EL_COL_BYTES;
+        const uint8_t *th = dm + (x & (dm_stride - 1));
+        while (i >= 0) {
+            const auto &c = render_cols[i];
+            int yl = c.yl;
+            int yh = c.yh;
+            if (yl == 0) yl = 1;
+            if (yh >= MAIN_VIEWHEIGHT - 1) yh = MAIN_VIEWHEIGHT - 2;
+
+            for (int y = yl; y <= yh; y++) {
+                int sy = fuzzoffset[fuzzpos] < 0 ? y - 1 : y + 1;
+                uint on = ((col0[sy >> 3] | col1[sy >> 3]) >> (sy & 7)) & 1u;
+                if (th[((y + EL_VIEW_Y) & (dm_size - 1)) * dm_stride] > 0xc0) on = 0;
+                col0[y >> 3] = (col0[y >> 3] & ~(1u << (y & 7))) | (on << (y & 7));
+                col1[y >> 3] &= ~(1u << (y & 7));
+
+                // Clamp table lookup index.
+                if (++fuzzpos == FUZZTABLE)
+                    fuzzpos = 0;
+            }
+            i = c.next;
+        }
+    }
+}
+#endif
+
+static int claim_fuzz_strip(spin_lock_t *lock) {
+    uint32_t save = spin_lock_blocking(lock);
+    int s = fuzz_strip_next;
+    if (s < SCREENWIDTH / FUZZ_STRIP_WIDTH) fuzz_strip_next = s + 1;
+    spin_unlock(lock, save);
+    return s < SCREENWIDTH / FUZZ_STRIP_WIDTH ? s : -1;
+}
+
+// called by both cores (with USE_CORE1_FOR_FUZZ) once all regular columns are drawn
+static void draw_fuzz_strips() {
+    spin_lock_t *lock = spin_lock_instance(RENDER_SPIN_LOCK);
+    for (int s; (s = claim_fuzz_strip(lock)) >= 0; ) {
+        int x0 = s * FUZZ_STRIP_WIDTH;
+#if EL_DIRECT_1B
+        if (render_direct) {
+            draw_fuzz_columns_1b(x0, x0 + FUZZ_STRIP_WIDTH);
+        } else
+#endif
+        draw_fuzz_columns(x0, x0 + FUZZ_STRIP_WIDTH);
+    }
+}
+
 static void draw_splash(int patch_num, int top, int bottom, uint8_t *dest, int single_col = -1) {
+    mark_rows_dirty(top, bottom);
     patch_decode_info pdi;
     get_patch_decoder(patch_num, &pdi);
     int w = patch_width(pdi.patch);
@@ -2464,6 +2876,7 @@ void draw_stbar_on_framebuffer(int frame, boolean refresh) {
     // we call ST_drawwidgets directly as we don't want to mess with palette stuff (we call this during startup when not initialized)
 //    ST_Drawer(false, refresh);
     ST_drawWidgets(refresh);
+    mark_rows_dirty(MAIN_VIEWHEIGHT, SCREENHEIGHT);
     // draw the status bar onto the bottom (now non visible part of the top buffer)
     I_VideoBuffer = frame_buffer[frame] - 32 * SCREENWIDTH;
     V_RestoreBuffer();
@@ -2472,6 +2885,7 @@ void draw_stbar_on_framebuffer(int frame, boolean refresh) {
 }
 
 static void draw_framebuffer_patches_fullscreen() {
+    mark_rows_dirty(0, SCREENHEIGHT);
     V_RestoreBuffer();
     vpatch_clip_bottom = MAIN_VIEWHEIGHT;
     V_DrawPatchList(vpatchlists->framebuffer);
@@ -2488,6 +2902,7 @@ void draw_fullscreen_background(int top, int bottom) {
     assert(top < bottom);
     assert((top < MAIN_VIEWHEIGHT && bottom <= MAIN_VIEWHEIGHT) ||
            (top >= MAIN_VIEWHEIGHT && bottom > MAIN_VIEWHEIGHT));
+    mark_rows_dirty(top, bottom);
     int patch_num = 0;
     byte *top_pixel = top < MAIN_VIEWHEIGHT ? render_frame_buffer + top * SCREENWIDTH :
                         frame_buffer[render_frame_index^1] + (top - 32) * SCREENWIDTH;
@@ -2502,18 +2917,15 @@ void draw_fullscreen_background(int top, int bottom) {
             if (finalestage == F_STAGE_TEXT) {
                 int picnum = W_GetNumForName(finaleflat);
                 if (picnum) {
-                    int cache_slot;
-                    uint8_t *flat_data = 0;
-                    for (cache_slot = 0; cache_slot < cached_flat_slots; cache_slot++) {
-                        if (cached_flat_picnum[cache_slot] == picnum) {
-                            flat_data = cached_flat0 - cache_slot * 4096;
-                        }
-                    }
-                    if (!flat_data) {
-                        // just use slot 0
-                        assert(cached_flat_slots);
-                        cache_slot = 0;
-                        flat_data = decode_flat_to_slot(cache_slot, picnum - firstflat); // note this uses core1's data area, but it is not drawing flats at the moment
+                    picnum -= firstflat;
+                    int cache_slot = find_cached_flat(picnum);
+                    uint8_t *flat_data;
+                    if (cache_slot >= 0) {
+                        touch_cached_flat(cache_slot);
+                        PD_PROFILE_COUNT(PD_PROF_FLAT_HITS, 1);
+                        flat_data = cached_flat0 - cache_slot * 4096;
+                    } else {
+                        flat_data = decode_flat_to_slot(lru_flat_slot(), picnum); // note this uses core1's data area, but it is not drawing flats at the moment
                     }
                     // todo is this rotated 90 degress
                     for (int y = top; y < bottom; y++) {
@@ -2586,6 +2998,7 @@ static void uh_oh_discard_columns(int render_col_limit) {
 }
 void pd_end_frame(int wipe_start) {
     DEBUG_PINS_SET(start_end, 2);
+    PD_PROFILE_START(t_frame);
 #if !PICO_ON_DEVICE
 //    tex_count.record_print(textures.size());
 //    patch_count.record_print(patches.size());
@@ -2594,6 +3007,7 @@ void pd_end_frame(int wipe_start) {
 #endif
     // these were only clipped as they were inserted (so may be more obscured)
     reclip_fuzz_columns();
+    PD_PROFILE_START(t_wait_display);
 #if PICO_ON_DEVICE
 //    gpio_put(22, 1);
     while (!sem_available(&display_frame_freed)) {
@@ -2602,6 +3016,8 @@ void pd_end_frame(int wipe_start) {
 //    gpio_put(22, 0);
 #endif
     sem_acquire_blocking(&display_frame_freed);
+    PD_PROFILE_END(PD_PROF_WAIT_DISPLAY, t_wait_display);
+    PD_PROFILE_START(t_setup);
     bool showing_help = inhelpscreens;
     static boolean was_in_help;
     if (gamestate == GS_LEVEL) {
@@ -2716,6 +3132,16 @@ void pd_end_frame(int wipe_start) {
         }
     }
     I_VideoBuffer = render_frame_buffer;
+#if EL_DIRECT_1B
+    // anything that is going to be read back out of the 8-bit frame buffer (wipes, the automap, help screens, the
+    // frame before a wipe) must still be rendered there, as must a view with a border
+    render_direct = gamestate == GS_LEVEL && !wipestate && !pre_wipe_state && !showing_help && !automapactive &&
+                    viewheight == MAIN_VIEWHEIGHT && scaledviewwidth == SCREENWIDTH;
+    if (render_direct) {
+        render_dm_id = render_frame_index ? 4 : 8; // same alternation as the display uses
+        memset(el_col_planes[render_frame_index], 0, sizeof(el_col_planes[0]));
+    }
+#endif
     if (wipestate) list_buffer_limit -= 4096;
     // we need to use the lower limit of this frame and the last since the final wipe frame may still be using the data
     uint8_t *this_time_limit = std::min(list_buffer_limit, last_list_buffer_limit);
@@ -2728,20 +3154,31 @@ void pd_end_frame(int wipe_start) {
     last_list_buffer_limit = list_buffer_limit;
 
     int new_cache_flat_slots = 1 + ((int)(cached_flat0 - list_buffer - render_col_count * sizeof(pd_column))) / 4096;
-    if (new_cache_flat_slots < 1) {
-        // flat 0 - list_buffer - render_col_count * 12 == 4096
-        int render_col_limit = (cached_flat0 - list_buffer ) / sizeof(pd_column);
+    if (new_cache_flat_slots < PD_MIN_CACHED_FLATS) {
+        // only when a wipe starts this frame and takes space render_col_budget didn't know about
+        // flat 0 - list_buffer - render_col_count * 12 == PD_MIN_CACHED_FLATS * 4096
+        int render_col_limit = (cached_flat0 - (PD_MIN_CACHED_FLATS - 1) * 4096 - list_buffer) / (int)sizeof(pd_column);
 //        printf("THIS IS A PROBLEM LIMIT TO %d cols\n", render_col_limit);
-        new_cache_flat_slots = 1;
+        new_cache_flat_slots = PD_MIN_CACHED_FLATS;
+        render_col_overflow += render_col_count - render_col_limit;
         uh_oh_discard_columns(render_col_limit);
-    } else if (render_col_count == RENDER_COL_MAX) {
-        static int foo;
-//        printf("OOPS MAXXED OUT %d\n", foo++);
     }
+#if DEBUG_COL_BUDGET
+    if (gamestate == GS_LEVEL) {
+        printf("COLS %d/%d hidden %d overflow %d flat slots %d\n", render_col_count, render_col_budget, render_col_hidden,
+               render_col_overflow, new_cache_flat_slots);
+    }
+#endif
+    PD_PROFILE_COUNT(PD_PROF_COLUMNS, render_col_count);
+    PD_PROFILE_COUNT(PD_PROF_COLUMN_OVERFLOW, render_col_overflow);
+    PD_PROFILE_COUNT(PD_PROF_VISPLANES, lastvisplane - visplanes);
     for(int i=cached_flat_slots; i<new_cache_flat_slots; i++) {
         cached_flat_picnum[i] = 0xff;
     }
     cached_flat_slots = new_cache_flat_slots;
+#if USE_CORE1_FOR_FLATS
+    prefetch_flat_picnum = gamestate == GS_LEVEL && !wipestate ? pick_prefetch_flat() : 0xff;
+#endif
 
     if (showing_help) {
         // bit hacky, but does the job (we don't want to draw anything at all when fully covered
@@ -2761,17 +3198,25 @@ void pd_end_frame(int wipe_start) {
             }
         }
     }
-    // render the visplane identifiers, freeing up the visplane columns (which we will use below)
-    int16_t fr_list = predraw_visplanes();
+    if (gamestate == GS_LEVEL) {
+        mark_rows_dirty(0, MAIN_VIEWHEIGHT);
+    }
+    // take the plane columns out of the column lists (the visplanes are drawn from them below)
+    predraw_visplanes();
+    PD_PROFILE_END(PD_PROF_SETUP, t_setup);
 
     // ... now we can be parallel
 #if !USE_CORE1_FOR_FLATS
-    draw_visplanes(fr_list);
+    PD_PROFILE_START(t_flats);
+    draw_visplanes();
+    PD_PROFILE_END(PD_PROF_FLATS, t_flats);
 #else
-    core1_fr_list = fr_list;
     sem_release(&core1_do_flats);
 #endif
+    PD_PROFILE_START(t_columns0);
     re_sort_regular_columns_by_fd_num();
+    fuzz_strip_next = 0;
+    fuzz_frame_pos = (fuzz_frame_pos + 1) % FUZZTABLE;
 #if USE_CORE1_FOR_REGULAR
     sem_release(&core1_do_regular);
 #endif
@@ -2783,9 +3228,26 @@ void pd_end_frame(int wipe_start) {
         draw_cast_sprite(sprite_lump);
     }
 #endif
+    PD_PROFILE_END(PD_PROF_COLUMNS0, t_columns0);
     sem_release(&core0_done);
+#if USE_CORE1_FOR_FUZZ
+    // fuzz reads back pixels either core may have drawn
+    PD_PROFILE_START(t_wait_regular1);
+    sem_acquire_blocking(&core1_regular_done);
+    PD_PROFILE_END(PD_PROF_WAIT_CORE1, t_wait_regular1);
+    PD_PROFILE_START(t_fuzz);
+    draw_fuzz_strips();
+    PD_PROFILE_END(PD_PROF_FUZZ, t_fuzz);
+#endif
+    PD_PROFILE_START(t_wait_core1);
     sem_acquire_blocking(&core1_done);
-    draw_fuzz_columns();
+    PD_PROFILE_END(PD_PROF_WAIT_CORE1, t_wait_core1);
+#if !USE_CORE1_FOR_FUZZ
+    PD_PROFILE_START(t_fuzz);
+    draw_fuzz_strips();
+    PD_PROFILE_END(PD_PROF_FUZZ, t_fuzz);
+#endif
+    PD_PROFILE_START(t_finish);
     DEBUG_PINS_CLR(full_render, 1);
     NetUpdate();
 
@@ -2914,6 +3376,10 @@ void pd_end_frame(int wipe_start) {
     // advance demo is set on the last frame of a demo, pre_wipe_state is set for last frame of gameplay in other state changes (by g_game)
     // inhelpscreens has skull which is in an iconvenient place
     bool render_menu_etc_to_fb = !advancedemo && !pre_wipe_state && next_video_type == VIDEO_TYPE_DOUBLE && !inhelpscreens;
+#if EL_DIRECT_1B
+    // the view area of the frame buffer is not displayed, so these must go to the overlay
+    if (render_direct) render_menu_etc_to_fb = false;
+#endif
     if (render_menu_etc_to_fb) {
         // render menu/hu to framebuffer (otherwise it goes to the overlay)
         V_BeginPatchList(vpatchlists->framebuffer);
@@ -2931,6 +3397,7 @@ void pd_end_frame(int wipe_start) {
 
     if (render_menu_etc_to_fb) {
         // render menu/hu to framebuffer
+        mark_rows_dirty(0, SCREENHEIGHT);
         V_RestoreBuffer();
         V_DrawPatchList(vpatchlists->framebuffer);
     }
@@ -2939,6 +3406,13 @@ void pd_end_frame(int wipe_start) {
     }
 
     next_frame_index = render_frame_index;
+#if EL_DISPLAY
+    memcpy(next_dirty_rows, render_dirty_rows, sizeof(render_dirty_rows));
+    memset(render_dirty_rows, 0, sizeof(render_dirty_rows));
+#endif
+#if EL_DIRECT_1B
+    next_frame_direct = render_direct;
+#endif
     next_overlay_index = render_overlay_index;
     render_overlay_index ^= 1;
 #if !DEMO1_ONLY
@@ -2948,6 +3422,11 @@ void pd_end_frame(int wipe_start) {
 #endif
 #if 0 && !PICO_ON_DEVICE
     printf("GS %d vt %d fi %d\n", gamestate, next_video_type, next_frame_index);
+#endif
+    PD_PROFILE_END(PD_PROF_FINISH, t_finish);
+    PD_PROFILE_END(PD_PROF_FRAME, t_frame);
+#if PD_PROFILE
+    pd_profile_end_frame();
 #endif
     sem_release(&render_frame_ready);
     DEBUG_PINS_CLR(start_end, 2);
@@ -2960,19 +3439,37 @@ void pd_core1_loop() {
     while (!sem_acquire_timeout_ms(&core1_do_flats, 1)) {
         SafeUpdateSound();
     }
+    uint16_t flat_clock_at_frame_start = flat_use_clock;
     interp_in_use = true;
-    draw_visplanes(core1_fr_list);
+    PD_PROFILE_START(t_flats);
+    draw_visplanes();
+    PD_PROFILE_END(PD_PROF_FLATS, t_flats);
     interp_in_use = false;
 #if USE_CORE1_FOR_REGULAR
     while (!sem_acquire_timeout_ms(&core1_do_regular, 1)) {
         SafeUpdateSound();
     }
+    PD_PROFILE_START(t_columns1);
     draw_regular_columns(1);
+    PD_PROFILE_END(PD_PROF_COLUMNS1, t_columns1);
+    sem_release(&core1_regular_done);
 #endif
 #endif
+    PD_PROFILE_START(t_idle);
     while (!sem_acquire_timeout_ms(&core0_done, 1)) {
+#if USE_CORE1_FOR_FLATS
+        PD_PROFILE_START(t_prefetch);
+        prefetch_flat(flat_clock_at_frame_start);
+        PD_PROFILE_END(PD_PROF_PREFETCH, t_prefetch);
+#endif
         SafeUpdateSound();
     }
+    PD_PROFILE_END(PD_PROF_IDLE1, t_idle);
+#if USE_CORE1_FOR_FUZZ
+    PD_PROFILE_START(t_fuzz);
+    draw_fuzz_strips();
+    PD_PROFILE_END(PD_PROF_FUZZ, t_fuzz);
+#endif
 #endif
     sem_release(&core1_done);
 }
@@ -3103,5 +3600,6 @@ void draw_cast_sprite(int sprite_lump) {
     memcpy(frame_buffer[render_frame_index] + top * SCREENWIDTH, render_frame_buffer, (MAIN_VIEWHEIGHT - top) * SCREENWIDTH);
     // bottom bit goes on the last 32 pixels of the other buffer
     memcpy(render_frame_buffer + (MAIN_VIEWHEIGHT-32) * SCREENWIDTH, render_frame_buffer + (MAIN_VIEWHEIGHT - top) * SCREENWIDTH, (top + height - MAIN_VIEWHEIGHT) * SCREENWIDTH);
+    mark_rows_dirty(top, top + height);
 }
 #endif
\ No newline at end of file
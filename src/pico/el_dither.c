@@ -0,0 +1,169 @@
+#include <string.h>
+#include <assert.h>
+#include "el_dither.h"
+#include "dither_maps.h"
+
+#if PICO_ON_DEVICE
+#include "pico.h"
+#else
+#define __not_in_flash_func(func_name) func_name
+#endif
+
+#define DM_EXPANDED_SIZE (DM_ROW_MIN_STRIDE * (1 + 2 + 4 + 8 + 16))
+
+dm_rows_t dm_rows[NUM_DITHER_MAPS];
+static uint8_t dm_expanded[DM_EXPANDED_SIZE];
+
+// error carried down to the next row (error diffusion engines); entries 0 and EL_DITHER_WIDTH + 1 are guards
+static int16_t err_row[EL_DITHER_WIDTH + 2];
+
+
+void dm_rows_init(void)
+{
+    uint8_t *exp = dm_expanded;
+
+    for (int dm_id = 0; dm_id < NUM_DITHER_MAPS; dm_id++)
+    {
+        unsigned int size = dither_maps[dm_id].size;
+
+        dm_rows[dm_id].size = size;
+        if (size >= DM_ROW_MIN_STRIDE)
+        {
+            dm_rows[dm_id].rows = dither_maps[dm_id].map;
+            dm_rows[dm_id].stride = size;
+        }
+        else
+        {
+            assert(exp + size * DM_ROW_MIN_STRIDE <= dm_expanded + sizeof(dm_expanded));
+            for (unsigned int y = 0; y < size; y++)
+            {
+                for (unsigned int x = 0; x < DM_ROW_MIN_STRIDE; x++)
+                {
+                    exp[y * DM_ROW_MIN_STRIDE + x] = dither_maps[dm_id].map[y * size + (x & (size - 1))];
+                }
+            }
+            dm_rows[dm_id].rows = exp;
+            dm_rows[dm_id].stride = DM_ROW_MIN_STRIDE;
+            exp += size * DM_ROW_MIN_STRIDE;
+        }
+    }
+}
+
+
+static inline void threshold_scanline(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y, int dm_id)
+{
+    const uint8_t *th_row = dm_row(dm_id, y);
+    unsigned int th_mask = dm_rows[dm_id].stride - 1;
+
+    for (int x = 0; x < EL_DITHER_WIDTH; x += 32)
+    {
+        *dst++ = threshold_32px(src + x, lum, th_row + (x & th_mask));
+    }
+}
+
+
+static void __not_in_flash_func(ordered_scanline)(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y,
+                                                  int frame, bool restart)
+{
+    threshold_scanline(dst, src, lum, y, frame ? 4 : 8);
+}
+
+
+static void __not_in_flash_func(blue_noise_scanline)(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y,
+                                                     int frame, bool restart)
+{
+    // BLUE_NOISE0 and BLUE_NOISE1; the second map is also shifted by half a tile so the pair decorrelates
+    threshold_scanline(dst, src, lum, y + (frame ? 32 : 0), 8 + (frame & 1));
+}
+
+
+// one row of serpentine error diffusion, with only err_row carried between rows. the error for the row below is
+// kept in two running sums, as its position ahead of x is still to be read for this row
+static inline void diffuse_scanline(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y, bool restart,
+                                    bool atkinson)
+{
+    int16_t *err = err_row + 1;
+    int d = (y & 1) ? -1 : 1;
+    int x = d > 0 ? 0 : EL_DITHER_WIDTH - 1;
+    int carry = 0;          // error for x + d from this row
+    int carry2 = 0;         // error for x + 2d from this row (atkinson)
+    int below_prev = 0;     // error for x - d of the next row
+    int below_cur = 0;      // error for x of the next row
+    uint32_t bits = 0;
+
+    if (restart)
+    {
+        memset(err_row, 0, sizeof(err_row));
+    }
+    for (int n = 0; n < EL_DITHER_WIDTH; n++, x += d)
+    {
+        int v = lum[src[x]] + err[x] + carry;
+        uint32_t on = v >= 128;
+        int e = v - (int)(-on & 255u);
+
+        // pixels arrive in either order, so shift them in from whichever end makes x & 31 the bit position
+        if (d > 0)
+        {
+            bits = (bits >> 1) | (on << 31);
+            if ((x & 31) == 31)
+            {
+                dst[x >> 5] = bits;
+            }
+        }
+        else
+        {
+            bits = (bits << 1) | on;
+            if (!(x & 31))
+            {
+                dst[x >> 5] = bits;
+            }
+        }
+        if (atkinson)
+        {
+            // 1/8 each to x+d, x+2d and x-d, x, x+d on the next row; the 1/8 that goes two rows down is
+            // folded into x on the next row, as there is only one row of error kept
+            int e8 = e >> 3;
+
+            carry = carry2 + e8;
+            carry2 = e8;
+            err[x - d] = below_prev + e8;
+            below_prev = below_cur + 2 * e8;
+            below_cur = e8;
+        }
+        else
+        {
+            int e7 = (e * 7) >> 4;
+            int e3 = (e * 3) >> 4;
+            int e5 = (e * 5) >> 4;
+
+            carry = e7;
+            err[x - d] = below_prev + e3;
+            below_prev = below_cur + e5;
+            below_cur = e - e7 - e3 - e5;
+        }
+    }
+    err[x - d] = below_prev;
+}
+
+
+static void __not_in_flash_func(floyd_steinberg_scanline)(uint32_t *dst, const uint8_t *src, const uint8_t *lum,
+                                                          int y, int frame, bool restart)
+{
+    diffuse_scanline(dst, src, lum, y, restart, false);
+}
+
+
+static void __not_in_flash_func(atkinson_scanline)(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y,
+                                                   int frame, bool restart)
+{
+    diffuse_scanline(dst, src, lum, y, restart, true);
+}
+
+
+const el_dither_engine_t el_dither_engines[NUM_EL_DITHER_ENGINES] =
+{
+    [EL_DITHER_ORDERED] = { "ordered", ordered_scanline, false },
+    [EL_DITHER_BLUE_NOISE] = { "blue noise", blue_noise_scanline, false },
+    [EL_DITHER_FLOYD_STEINBERG] = { "floyd-steinberg", floyd_steinberg_scanline, true },
+    [EL_DITHER_ATKINSON] = { "atkinson", atkinson_scanline, true },
+};
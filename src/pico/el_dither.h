@@ -0,0 +1,73 @@
+#ifndef __EL_DITHER_H
+#define __EL_DITHER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// 1-bit conversion kernels for the EL display. this has no pico or doom dependencies so that it can also be
+// built into the host benchmark (el_dither_bench.c)
+
+#define EL_DITHER_WIDTH 320 // SCREENWIDTH
+
+// dither map rows are read in runs of 32 thresholds (one output word); maps narrower than
+// that are pre-expanded so that every row is at least DM_ROW_MIN_STRIDE wide
+#define DM_ROW_MIN_STRIDE 32
+
+typedef struct
+{
+    const uint8_t *rows;
+    uint16_t size;          // rows in the map (power of 2)
+    uint16_t stride;        // bytes per row (power of 2, >= DM_ROW_MIN_STRIDE)
+} dm_rows_t;
+
+extern dm_rows_t dm_rows[];
+
+void dm_rows_init(void);
+
+static inline const uint8_t *dm_row(int dm_id, int y)
+{
+    return dm_rows[dm_id].rows + (y & (dm_rows[dm_id].size - 1)) * dm_rows[dm_id].stride;
+}
+
+static inline uint8_t dm_val(int dm_id, int x, int y)
+{
+    return dm_row(dm_id, y)[x & (dm_rows[dm_id].stride - 1)];
+}
+
+// threshold 32 pixels into one word of the 1-bit buffer (pixel 0 in bit 0). th - 1 - lum
+// goes negative exactly when lum >= th, so the sign bit is the output pixel, and it is
+// shifted in from the top so no per pixel shift amount is needed
+static inline uint32_t threshold_32px(const uint8_t *src, const uint8_t *lum, const uint8_t *th)
+{
+    uint32_t bits = 0;
+
+    for (int i = 0; i < 32; i++)
+    {
+        bits = (bits >> 1) | (((uint32_t)th[i] - 1u - lum[src[i]]) & 0x80000000u);
+    }
+    return bits;
+}
+
+enum
+{
+    EL_DITHER_ORDERED,          // bayer and blue noise maps alternating by frame index
+    EL_DITHER_BLUE_NOISE,       // the two blue noise maps alternating by frame index
+    EL_DITHER_FLOYD_STEINBERG,  // serpentine error diffusion
+    EL_DITHER_ATKINSON,         // serpentine, 3/4 of the error is diffused
+    NUM_EL_DITHER_ENGINES
+};
+
+typedef struct
+{
+    const char *name;
+    // convert one row of palette indexes (looked up through lum) to 1-bit, pixel 0 in bit 0 of dst[0]. y is the
+    // display row and frame the display frame index. engines that diffuse error must be given rows top to bottom;
+    // restart clears the carried error, and is set for the first row converted after a gap
+    void (*scanline)(uint32_t *dst, const uint8_t *src, const uint8_t *lum, int y, int frame, bool restart);
+    // the output of a row depends on the rows above it, so if a row changes, so do all those below it
+    bool diffuses;
+} el_dither_engine_t;
+
+extern const el_dither_engine_t el_dither_engines[NUM_EL_DITHER_ENGINES];
+
+#endif
@@ -0,0 +1,268 @@
+// host benchmark for the EL dither engines (el_dither.c): per scanline cost of each engine, and how far a box
+// filtered version of its output is from the input greyscale. it first checks the packed threshold conversion is bit
+// exact against the per pixel PUT_1B_PIXEL on the original dither maps, and fails if not. host timings are only a
+// guide to the relative cost on the RP2040, where the engines run in the core1 display IRQ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "el_dither.h"
+#include "dither_maps.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#define WIDTH EL_DITHER_WIDTH
+#define HEIGHT 200
+#define STRIDE_WORDS (WIDTH / 32)
+#define BOX 4
+
+static uint8_t frame[HEIGHT][WIDTH];
+static uint32_t out[HEIGHT][STRIDE_WORDS];
+static uint8_t lum[256];
+
+static void make_frame(void)
+{
+    uint32_t r = 12345;
+
+    // the EL palette is luminance, so an identity ramp is representative enough
+    for (int i = 0; i < 256; i++)
+    {
+        lum[i] = i;
+    }
+    for (int y = 0; y < HEIGHT; y++)
+    {
+        for (int x = 0; x < WIDTH; x++)
+        {
+            int v;
+
+            r = r * 1664525u + 1013904223u;
+            if (y < HEIGHT / 3)
+            {
+                v = x * 255 / (WIDTH - 1);                          // smooth ramp
+            }
+            else if (y < 2 * HEIGHT / 3)
+            {
+                v = 96 + ((x / 16 + y / 16) & 1) * 64 + (r >> 28);  // textured blocks
+            }
+            else
+            {
+                v = (r >> 24) / 2 + (y - 2 * HEIGHT / 3) * 2;       // dark noise
+            }
+            frame[y][x] = v > 255 ? 255 : v;
+        }
+    }
+}
+
+static uint32_t verify_rng = 1;
+
+// a random byte, with 0 and 255 more often than chance so the ends of the threshold range get checked
+static uint8_t verify_byte(void)
+{
+    verify_rng = verify_rng * 1664525u + 1013904223u;
+    switch (verify_rng >> 29)
+    {
+        case 0:
+            return 0;
+        case 1:
+            return 255;
+        default:
+            return verify_rng >> 16;
+    }
+}
+
+// PUT_1B_PIXEL in i_video_el.c: a pixel is set when its luminance is at least the threshold
+static int put_1b_pixel(uint8_t src_val, uint8_t th)
+{
+    return src_val >= th;
+}
+
+// a dither map threshold read straight from dither_maps, as PUT_1B_PIXEL did before dm_rows_init expanded the maps
+static uint8_t map_threshold(int dm_id, int x, int y)
+{
+    unsigned int size = dither_maps[dm_id].size;
+
+    return dither_maps[dm_id].map[size * (y & (size - 1)) + (x & (size - 1))];
+}
+
+// check that threshold_32px is bit exact against PUT_1B_PIXEL for random pixels, luminance tables and thresholds, and
+// that it and the threshold engines, reading the expanded dm_rows, match PUT_1B_PIXEL on the original dither maps
+// for random rows of every map
+static bool verify_packed(void)
+{
+    uint8_t src[EL_DITHER_WIDTH], th[32], lum_r[256];
+    uint32_t row[EL_DITHER_WIDTH / 32];
+
+    for (int n = 0; n < 200000; n++)
+    {
+        if (!(n & 255))
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                lum_r[i] = verify_byte();
+            }
+        }
+        uint32_t expect = 0;
+        for (int i = 0; i < 32; i++)
+        {
+            src[i] = verify_byte();
+            th[i] = verify_byte();
+            expect |= (uint32_t)put_1b_pixel(lum_r[src[i]], th[i]) << i;
+        }
+        uint32_t got = threshold_32px(src, lum_r, th);
+        if (got != expect)
+        {
+            printf("threshold_32px mismatch: %08x vs PUT_1B_PIXEL %08x\n", got, expect);
+            return false;
+        }
+    }
+    for (int y = 0; y < 256; y++)
+    {
+        for (int dm_id = 0; dm_id < NUM_DITHER_MAPS; dm_id++)
+        {
+            const uint8_t *th_row = dm_row(dm_id, y);
+            unsigned int th_mask = dm_rows[dm_id].stride - 1;
+
+            for (int x = 0; x < EL_DITHER_WIDTH; x++)
+            {
+                src[x] = verify_byte();
+            }
+            for (int x = 0; x < EL_DITHER_WIDTH; x += 32)
+            {
+                row[x >> 5] = threshold_32px(src + x, lum_r, th_row + (x & th_mask));
+            }
+            for (int x = 0; x < EL_DITHER_WIDTH; x++)
+            {
+                int expect = put_1b_pixel(lum_r[src[x]], map_threshold(dm_id, x, y));
+                if ((int)((row[x >> 5] >> (x & 31)) & 1) != expect)
+                {
+                    printf("dither map %d mismatch at x %d y %d\n", dm_id, x, y);
+                    return false;
+                }
+            }
+        }
+        for (int e = EL_DITHER_ORDERED; e <= EL_DITHER_BLUE_NOISE; e++)
+        {
+            for (int frame_index = 0; frame_index < 2; frame_index++)
+            {
+                // the maps and row offsets ordered_scanline and blue_noise_scanline use
+                int dm_id = e == EL_DITHER_ORDERED ? (frame_index ? 4 : 8) : 8 + frame_index;
+                int dm_y = e == EL_DITHER_ORDERED ? y : y + (frame_index ? 32 : 0);
+
+                for (int x = 0; x < EL_DITHER_WIDTH; x++)
+                {
+                    src[x] = verify_byte();
+                }
+                el_dither_engines[e].scanline(row, src, lum_r, y, frame_index, true);
+                for (int x = 0; x < EL_DITHER_WIDTH; x++)
+                {
+                    int expect = put_1b_pixel(lum_r[src[x]], map_threshold(dm_id, x, dm_y));
+                    if ((int)((row[x >> 5] >> (x & 31)) & 1) != expect)
+                    {
+                        printf("%s scanline mismatch at x %d y %d frame %d\n", el_dither_engines[e].name, x, y,
+                               frame_index);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    printf("packed threshold conversion matches PUT_1B_PIXEL\n");
+    return true;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run_frame(const el_dither_engine_t *engine, int frame_index)
+{
+    for (int y = 0; y < HEIGHT; y++)
+    {
+        engine->scanline(out[y], frame[y], lum, y + 28, frame_index, y == 0);
+    }
+}
+
+// mean absolute difference between BOX x BOX averages of the input and of the 1-bit output (0-255 scale)
+static double box_error(void)
+{
+    double total = 0;
+    int count = 0;
+
+    for (int by = 0; by + BOX <= HEIGHT; by += BOX)
+    {
+        for (int bx = 0; bx + BOX <= WIDTH; bx += BOX)
+        {
+            int in = 0, on = 0;
+
+            for (int y = by; y < by + BOX; y++)
+            {
+                for (int x = bx; x < bx + BOX; x++)
+                {
+                    in += lum[frame[y][x]];
+                    on += (out[y][x >> 5] >> (x & 31)) & 1;
+                }
+            }
+            total += abs(in - on * 255) / (double)(BOX * BOX);
+            count++;
+        }
+    }
+    return total / count;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 500;
+    double base_ns = 0;
+
+    if (frames <= 0)
+    {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+    dm_rows_init();
+    if (!verify_packed())
+    {
+        return 1;
+    }
+    make_frame();
+    printf("%-16s %12s %14s %10s %10s\n", "engine", "ns/scanline", "cycles/scanline", "vs ordered", "box error");
+    for (int e = 0; e < NUM_EL_DITHER_ENGINES; e++)
+    {
+        const el_dither_engine_t *engine = &el_dither_engines[e];
+
+        run_frame(engine, 0); // warm up
+        double t0 = now_ns();
+#if HAVE_RDTSC
+        uint64_t c0 = __rdtsc();
+#endif
+        for (int f = 0; f < frames; f++)
+        {
+            run_frame(engine, f & 1);
+        }
+#if HAVE_RDTSC
+        double cycles = (double)(__rdtsc() - c0) / ((double)frames * HEIGHT);
+#else
+        double cycles = 0;
+#endif
+        double ns = (now_ns() - t0) / ((double)frames * HEIGHT);
+        if (!e)
+        {
+            base_ns = ns;
+        }
+        // the ordered engines alternate maps by frame, so average the error over a frame pair
+        run_frame(engine, 0);
+        double err = box_error();
+        run_frame(engine, 1);
+        err = (err + box_error()) / 2;
+        printf("%-16s %12.1f %14.0f %9.2fx %10.2f\n", engine->name, ns, cycles, ns / base_ns, err);
+    }
+    return 0;
+}
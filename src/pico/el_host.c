@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "el_host.h"
+
+static FILE *capture;
+static const char *pbm_prefix;
+static unsigned long capture_frames_max;
+static unsigned long frames_sent;
+static int timing;
+
+static uint64_t time_total[NUM_EL_TIMES];
+static unsigned long time_count[NUM_EL_TIMES];
+
+static const char *const time_names[NUM_EL_TIMES] =
+{
+    [EL_TIME_PASS] = "pass",
+    [EL_TIME_NEW_FRAME] = "new frame",
+    [EL_TIME_BASE] = "base rows",
+    [EL_TIME_OVERLAYS] = "overlay rows",
+    [EL_TIME_PWM_SPLIT] = "pwm split",
+};
+
+
+static void el_host_report(void)
+{
+    if (capture)
+    {
+        fclose(capture);
+    }
+    if (!timing || !time_count[EL_TIME_PASS])
+    {
+        return;
+    }
+    printf("EL: %lu frames sent, %lu conversion passes\n", frames_sent, time_count[EL_TIME_PASS]);
+    printf("%-14s %10s %12s %12s %12s\n", "stage", "calls", "total ms", "us/call", "us/pass");
+    for (int i = 0; i < NUM_EL_TIMES; i++)
+    {
+        if (time_count[i])
+        {
+            printf("%-14s %10lu %12.2f %12.3f %12.2f\n", time_names[i], time_count[i], time_total[i] / 1e6,
+                   time_total[i] / 1e3 / time_count[i], time_total[i] / 1e3 / time_count[EL_TIME_PASS]);
+        }
+    }
+}
+
+
+void el_host_init(void)
+{
+    const char *s;
+
+    if ((s = getenv("EL_CAPTURE")) != NULL)
+    {
+        capture = fopen(s, "wb");
+        if (!capture)
+        {
+            fprintf(stderr, "EL: can't open %s for capture\n", s);
+        }
+    }
+    pbm_prefix = getenv("EL_PBM");
+    if ((s = getenv("EL_CAPTURE_FRAMES")) != NULL)
+    {
+        capture_frames_max = strtoul(s, NULL, 0);
+    }
+    timing = getenv("EL_TIMING") != NULL;
+    atexit(el_host_report);
+}
+
+
+static void write_pbm(uint32_t hdr, const uint8_t *bits)
+{
+    char name[FILENAME_MAX];
+    int w = (hdr & 0xffff) + 1;
+    int h = (hdr >> 16) + 1;
+    FILE *f;
+
+    snprintf(name, sizeof(name), "%s%06lu.pbm", pbm_prefix, frames_sent);
+    if (!(f = fopen(name, "wb")))
+    {
+        return;
+    }
+    // PBM is msb first with 1 for black, so lit pixels (1 here) come out white
+    fprintf(f, "P4\n%d %d\n", w, h);
+    for (int i = 0; i < w * h / 8; i++)
+    {
+        uint8_t b = bits[i];
+
+        b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+        b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+        b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+        fputc(b ^ 0xff, f);
+    }
+    fclose(f);
+}
+
+
+void el_host_send_frame(uint32_t hdr, const uint8_t *bits, unsigned int bytes)
+{
+    if (!capture_frames_max || frames_sent < capture_frames_max)
+    {
+        if (capture)
+        {
+            // the same words, in the same order, as the PIO TX FIFO would see
+            uint8_t h[4] = { hdr, hdr >> 8, hdr >> 16, hdr >> 24 };
+
+            fwrite(h, 1, sizeof(h), capture);
+            fwrite(bits, 1, bytes, capture);
+        }
+        if (pbm_prefix)
+        {
+            write_pbm(hdr, bits);
+        }
+    }
+    frames_sent++;
+}
+
+
+uint64_t el_host_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void el_host_add_time(int which, uint64_t ns)
+{
+    time_total[which] += ns;
+    time_count[which]++;
+}
@@ -0,0 +1,39 @@
+#ifndef __EL_HOST_H
+#define __EL_HOST_H
+
+#include <stdint.h>
+
+// host (non device) stand in for the EL display hardware, used by i_video_el.c. there is no PIO or DMA, so each
+// frame that would have been DMAed to the PIO TX FIFO is handed to el_host_send_frame instead, which can write:
+//
+//   EL_CAPTURE=<file>          the exact 32-bit word stream the PIO would have been given (little endian; each frame
+//                              is the size header then the 1-bit rows, pixel 0 in bit 0)
+//   EL_PBM=<prefix>            each frame as <prefix>NNNNNN.pbm
+//   EL_CAPTURE_FRAMES=<n>      stop capturing after n frames
+//   EL_TIMING=1                print the time spent in each conversion stage on exit
+//
+// (these are environment variables, as the doom_tiny builds have no command line arguments)
+
+// roughly the panel refresh period with the PIO at clkdiv 10
+#define EL_HOST_REFRESH_US 12500
+
+enum
+{
+    EL_TIME_PASS,               // draw_1b_buffer as a whole
+    EL_TIME_NEW_FRAME,          // new_frame_stuff (frame handoff, overlay lists, palette, wipe)
+    EL_TIME_BASE,               // the scanline functions
+    EL_TIME_OVERLAYS,           // overlay decoding and merging
+    EL_TIME_PWM_SPLIT,          // splitting greyscale rows into bit planes
+    NUM_EL_TIMES
+};
+
+void el_host_init(void);
+void el_host_send_frame(uint32_t hdr, const uint8_t *bits, unsigned int bytes);
+uint64_t el_host_time_ns(void);
+void el_host_add_time(int which, uint64_t ns);
+
+// time a stage (nothing on the device)
+#define EL_TIME_START(t) uint64_t t = el_host_time_ns()
+#define EL_TIME_END(which, t) el_host_add_time(which, el_host_time_ns() - (t))
+
+#endif
@@ -31,10 +31,14 @@
 #include "hardware/gpio.h"
 #include "picodoom.h"
 #include "image_decoder.h"
+#if PICO_ON_DEVICE
 #include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/structs/xip_ctrl.h"
-#include "dither_maps.h"
+#else
+#include "el_host.h"
+#endif
+#include "el_dither.h"
 
 #define EL_VS_PIN    16
 #define EL_HS_PIN    17
@@ -47,13 +51,20 @@
 #define EL_DISP_WH_HDR  (((EL_DISP_HEIGHT - 1) << 16) | (EL_DISP_WIDTH - 1))
 
 
+#if PICO_ON_DEVICE
 #include "el.pio.h"
+#define EL_TIME_START(t)
+#define EL_TIME_END(which, t)
+#endif
 
 #define LOW_PRIO_IRQ 31
 
 volatile uint32_t sw_number = 103;
 
+#if PICO_ON_DEVICE
 static int32_t dma_chan = -1; 
+static int32_t ctrl_chan = -1; // with EL_DOUBLE_1B or EL_PWM_PLANES, reloads dma_chan when a frame is sent
+#endif
 
 static const patch_t *stbar;
 volatile uint8_t interp_in_use;
@@ -76,20 +87,139 @@ volatile uint8_t wipe_min;
 uint8_t *wipe_yoffsets;
 int16_t *wipe_yoffsets_raw;
 uint32_t *wipe_linelookup;
+// first column of each run of the wipe (see build_wipe_runs), then SCREENWIDTH
+#define WIPE_MAX_RUNS (SCREENWIDTH + SCREENWIDTH / 32)
+static uint16_t wipe_run_x[WIPE_MAX_RUNS + 1];
+static uint16_t wipe_num_runs;
+static uint8_t wipe_max; // rows below this are all old screen
 
 uint8_t *next_video_scroll;
 uint8_t *video_scroll;
 
 uint8_t __aligned(4) frame_buffer[2][SCREENWIDTH * MAIN_VIEWHEIGHT];
+
+// a whole frame as sent by a single DMA, for when the DMA is chained without the CPU
+typedef struct
+{
+    uint32_t hdr;                                       // EL_DISP_WH_HDR, sent by the PIO program before each frame
+    uint8_t bits[EL_DISP_STRIDE * EL_DISP_HEIGHT];
+} el_1b_frame_t;
+
+#if EL_DOUBLE_1B && EL_PWM_PLANES
+#error EL_DOUBLE_1B and EL_PWM_PLANES cannot be used together
+#endif
+#if EL_DOUBLE_1B
+// two 1-bit buffers. the control channel re-sends whichever front_1b points to each time a frame has gone out, so
+// the next is converted into the other (back) buffer while this one is shown, and is picked up at a frame
+// boundary once complete, without the CPU
+#define NUM_1B_BUFFERS 2
+static el_1b_frame_t __aligned(4) frames_1b[NUM_1B_BUFFERS];
+static el_1b_frame_t *volatile front_1b = &frames_1b[0];
+static uint8_t back_1b = 1;
+#define frame_buffer_1b (frames_1b[back_1b].bits) // the conversion always writes the back buffer
+#elif !EL_PWM_PLANES
+#define NUM_1B_BUFFERS 1
 static uint8_t __aligned(4) frame_buffer_1b[EL_DISP_STRIDE * EL_DISP_HEIGHT] = {0};
-static uint8_t palette[256];
-static uint8_t shared_pal[NUM_SHARED_PALETTES][16];
+#define back_1b 0
+#else
+#if EL_DIRECT_1B
+#error EL_PWM_PLANES does not support EL_DIRECT_1B
+#endif
+#if EL_PWM_PLANES < 2 || EL_PWM_PLANES > 4
+#error EL_PWM_PLANES must be 2, 3 or 4
+#endif
+// temporal greyscale: each frame is split into bit planes which a pair of DMA channels show in turn, without
+// the CPU, so a plane shown for more refreshes is brighter. plane 0 is shown once and planes 1 and up 1, 2, 4
+// times, so the EL_PWM_SLOTS refreshes of a cycle give EL_PWM_SLOTS + 1 evenly spaced grey levels. there are two
+// sets of planes: rows are split into the back set while the other is shown, and the slots are only pointed at it
+// between cycles, so a cycle never mixes planes of two frames
+#define EL_PWM_SLOTS (1 << (EL_PWM_PLANES - 1))
+#define NUM_1B_BUFFERS 2
+static el_1b_frame_t __aligned(4) pwm_planes[NUM_1B_BUFFERS][EL_PWM_PLANES];
+static uint8_t back_1b = 1;
+// the plane for each refresh of a cycle; the control channel reads this with a ring wrap
+static const el_1b_frame_t *pwm_slots[EL_PWM_SLOTS] __aligned(EL_PWM_SLOTS * sizeof(void *));
+// per luminance: the plane mask for the lower (bits 8-15) and upper (bits 16-23) grey levels either side, and
+// the fraction of the way to the upper one (bits 0-7) which is dithered against a threshold map
+static uint32_t pwm_lut[256];
+// the row being drawn (base and overlays), as luminance. like ov_val/ov_mask it is wide enough for any overlay entry x
+// (9 bits) plus a full width patch, so overlays need no clipping; only the first SCREENWIDTH bytes are shown
+#define PWM_ROW_BYTES (512 + SCREENWIDTH)
+static uint8_t pwm_row[PWM_ROW_BYTES];
+#if PICO_ON_DEVICE
+static uint8_t pwm_slot;
+static volatile int8_t pwm_next_set = -1; // the set of planes to show from the next cycle, or -1
+#endif
+#define WIPE_STEPS_PER_PASS EL_PWM_SLOTS
+#endif
+#ifndef WIPE_STEPS_PER_PASS
+#define WIPE_STEPS_PER_PASS 1
+#endif
+
+// greyscale versions of the PLAYPAL palettes (and of the shared 16 color vpatch palettes). with EL_GREY_PALETTE_CACHE
+// (the default) each is built on first use at the current gamma (about 4.5K of RAM), so that the frequent palette
+// changes of damage and bonus flashes are just a pointer swap; a wipe has its own slot, as the UI reds are not maxed
+// out during one. otherwise the one palette is rebuilt on every change
+#ifndef EL_GREY_PALETTE_CACHE
+#define EL_GREY_PALETTE_CACHE 1
+#endif
+#define NUM_PLAYPALS 14
+#if EL_GREY_PALETTE_CACHE
+#define GREY_WIPE_SLOT NUM_PLAYPALS
+#define NUM_GREY_SLOTS (NUM_PLAYPALS + 1)
+#else
+#define NUM_GREY_SLOTS 1
+#endif
+typedef struct
+{
+    uint8_t lum[256];
+    uint8_t shared[NUM_SHARED_PALETTES][16];
+} grey_palette_t;
+static grey_palette_t grey_palettes[NUM_GREY_SLOTS];
+#if EL_GREY_PALETTE_CACHE
+static int8_t grey_slot_pal[NUM_GREY_SLOTS]; // the palette in each slot, or -1
+static int8_t grey_gamma = -1;
+#endif
+static const uint8_t *palette = grey_palettes[0].lum;
+static const uint8_t (*shared_pal)[16] = grey_palettes[0].shared;
+const uint8_t *el_lum_palette = grey_palettes[0].lum;
 static int8_t next_pal=-1;
 
+enum
+{
+    EL_CONTRAST_LINEAR,
+    EL_CONTRAST_DOUBLE,         // twice the luminance, clipped
+    EL_CONTRAST_S_CURVE,        // darker darks and brighter lights, without clipping
+    EL_CONTRAST_LIFT,           // brighter darks
+};
+// curves for the palettes read from PLAYPAL, and for the damage/bonus palettes that are tinted from the first one
+// when whd_gen has dropped the other 13 (as it does for standard WADs)
+#ifndef EL_CONTRAST_DEFAULT
+#define EL_CONTRAST_DEFAULT EL_CONTRAST_DOUBLE
+#endif
+#ifndef EL_TINT_CONTRAST_DEFAULT
+#define EL_TINT_CONTRAST_DEFAULT EL_CONTRAST_LINEAR
+#endif
+
+#if EL_DIRECT_1B
+uint8_t __aligned(4) el_col_planes[2][2][SCREENWIDTH * EL_COL_BYTES];
+uint8_t next_frame_direct;
+static uint8_t display_frame_direct;
+// 8 rows are transposed at a time, but copied out a row at a time as rows are found to be dirty
+static uint8_t __aligned(4) direct_rows[8 * EL_DISP_STRIDE];
+static int direct_rows_block;
+#endif
+
 uint8_t display_frame_index;
 uint8_t display_overlay_index;
 uint8_t display_video_type;
 
+// frame_buffer_1b is kept between passes, so only rows whose source has changed are converted again. with two
+// buffers, a change has to be converted into each, so every change is marked for both
+uint32_t next_dirty_rows[DIRTY_ROW_WORDS];
+static uint32_t dirty_rows[NUM_1B_BUFFERS][DIRTY_ROW_WORDS];
+static uint32_t overlay_row_sig[SCREENHEIGHT]; // hash of the overlays last drawn on each row
+
 typedef void (*scanline_func)(int scanline);
 
 static void scanline_func_none(int scanline);
@@ -110,10 +240,9 @@ scanline_func scanline_funcs[] = {
 // CU_SELECT_DEBUG_PINS(dbg1);
 // CU_SELECT_DEBUG_PINS(dbg2)
 
-#define DM_X(px, dm_id) ((px) & (dither_maps[dm_id].size - 1))
-#define DM_Y(py, dm_id) ((py) & (dither_maps[dm_id].size - 1))
-#define DM_VAL(px, py, dm_id) (dither_maps[dm_id].map[(dither_maps[dm_id].size * DM_Y((py), dm_id) + DM_X((px), dm_id))])
+#define DM_VAL(px, py, dm_id) dm_val(dm_id, px, py)
 
+#if !EL_PWM_PLANES
 #define BUF1B_BYTE_ID(x, y) (((y) * EL_DISP_STRIDE) + ((x) >> 3))
 
 #define SET_1B_PIXEL(x, y) (frame_buffer_1b[BUF1B_BYTE_ID(x, y)] |= 1 << (x & 7))
@@ -122,16 +251,169 @@ scanline_func scanline_funcs[] = {
                                              (SET_1B_PIXEL((x), (y))) :\
                                              (UNSET_1B_PIXEL((x), (y))))
 
-#define PUT_1B_PIXEL_ST(x, y, src_val, dm_id) (((src_val >= 80 ? \
+// overlay rows are decoded into ov_val and ov_mask (bit x is screen x), and then merged into frame_buffer_1b a
+// word at a time. the rows are wide enough for any entry x (9 bits) plus a full width patch
+#define OV_ROW_WORDS ((512 + SCREENWIDTH + 31) / 32)
+static uint32_t ov_val[OV_ROW_WORDS];
+static uint32_t ov_mask[OV_ROW_WORDS];
+
+#define PUT_1B_PIXEL_ST(x, y, src_val, dm_id) (ov_mask[(x) >> 5] |= 1u << ((x) & 31),\
+                                ov_val[(x) >> 5] |= (uint32_t)((src_val >= 80 ? \
+                                MIN(255, (int16_t)src_val + 32) :\
+                                MAX(0, (int16_t)src_val - 32)) >= DM_VAL((x), (y), dm_id)) << ((x) & 31))
+#else
+// overlay pixels are composed into pwm_row, and the whole row is split into the planes once drawn
+#define PUT_1B_PIXEL_ST(x, y, src_val, dm_id) ((void)(dm_id), pwm_row[x] = (src_val >= 80 ? \
                                 MIN(255, (int16_t)src_val + 32) :\
-                                MAX(0, (int16_t)src_val - 32)) >= DM_VAL((x), (y), dm_id)) ?\
-                                                                  (SET_1B_PIXEL((x), (y))) :\
-                                                                  (UNSET_1B_PIXEL((x), (y))))
+                                MAX(0, (int16_t)src_val - 32)))
+#endif
+
+// RAM for pre-dithered overlay rows (e.g. 4096), which spares redrawing the status bar and menus each frame; off by
+// default, as it is that much RAM on top of everything else
+#ifndef EL_OVERLAY_CACHE_BYTES
+#define EL_OVERLAY_CACHE_BYTES 0
+#endif
+#define EL_OVERLAY_CACHE (EL_OVERLAY_CACHE_BYTES && !EL_PWM_PLANES)
+
+#ifndef EL_DITHER_DEFAULT
+#define EL_DITHER_DEFAULT EL_DITHER_ORDERED
+#endif
+static const el_dither_engine_t *dither_engine = &el_dither_engines[EL_DITHER_DEFAULT];
+static int last_converted_row; // to tell the engine when rows have been skipped
+
+
+#if EL_DIRECT_1B
+const uint8_t *el_dither_rows(int dm_id, unsigned int *size, unsigned int *stride)
+{
+    *size = dm_rows[dm_id].size;
+    *stride = dm_rows[dm_id].stride;
+    return dm_rows[dm_id].rows;
+}
+
+
+// transpose 8 column bytes (bit n = row n) into 8 row bytes (bit n = column n)
+static inline void transpose_8x8(const uint8_t *col, uint8_t *row)
+{
+    uint32_t lo = col[0] | (col[1] << 8) | (col[2] << 16) | ((uint32_t)col[3] << 24);
+    uint32_t hi = col[4] | (col[5] << 8) | (col[6] << 16) | ((uint32_t)col[7] << 24);
+    uint32_t t;
+
+    t = (lo ^ (lo >> 7)) & 0x00aa00aau;
+    lo ^= t ^ (t << 7);
+    t = (hi ^ (hi >> 7)) & 0x00aa00aau;
+    hi ^= t ^ (t << 7);
+    t = (lo ^ (lo >> 14)) & 0x0000ccccu;
+    lo ^= t ^ (t << 14);
+    t = (hi ^ (hi >> 14)) & 0x0000ccccu;
+    hi ^= t ^ (t << 14);
+    t = ((lo >> 4) ^ hi) & 0x0f0f0f0fu;
+    hi ^= t;
+    lo ^= t << 4;
+    for (int i = 0; i < 4; i++)
+    {
+        row[i * EL_DISP_STRIDE] = lo >> (8 * i);
+        row[(i + 4) * EL_DISP_STRIDE] = hi >> (8 * i);
+    }
+}
+
+
+// the render cores have already dithered the view, so this is just a transpose of 8 rows at a time
+static void __not_in_flash_func(convert_direct_rows)(int scanline)
+{
+    const uint8_t *p0 = el_col_planes[display_frame_index][0] + (scanline >> 3);
+    const uint8_t *p1 = el_col_planes[display_frame_index][1] + (scanline >> 3);
+    uint8_t *dst = direct_rows;
+    uint8_t col[8];
+
+    for (int x = 0; x < SCREENWIDTH; x += 8)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            col[i] = p0[(x + i) * EL_COL_BYTES] | p1[(x + i) * EL_COL_BYTES];
+        }
+        transpose_8x8(col, dst++);
+    }
+}
+#endif
+
+
+#if EL_PWM_PLANES
+// point the slots at a set of planes
+static inline void pwm_show(int set)
+{
+    for (int s = 0; s < EL_PWM_SLOTS; s++)
+    {
+        // spread the refreshes of each plane over the cycle; slot s (s > 0) shows plane
+        // EL_PWM_PLANES - 1 - ctz(s), so the most significant plane is every other slot
+        pwm_slots[s] = &pwm_planes[set][s ? EL_PWM_PLANES - 1 - __builtin_ctz(s) : 0];
+    }
+}
+
+
+static void pwm_init(void)
+{
+    for (int l = 0; l < 256; l++)
+    {
+        int v = l * EL_PWM_SLOTS;
+        int q = v / 255;
+        uint32_t mask[2];
+
+        for (int i = 0; i < 2; i++)
+        {
+            int level = MIN(q + i, EL_PWM_SLOTS);
+
+            // the top level is every plane, below that plane 0 is off and the others are the level in binary
+            mask[i] = level == EL_PWM_SLOTS ? (1u << EL_PWM_PLANES) - 1 : (uint32_t)level << 1;
+        }
+        pwm_lut[l] = ((v % 255) * 256 / 255) | (mask[0] << 8) | (mask[1] << 16);
+    }
+    for (int b = 0; b < NUM_1B_BUFFERS; b++)
+    {
+        for (int p = 0; p < EL_PWM_PLANES; p++)
+        {
+            pwm_planes[b][p].hdr = EL_DISP_WH_HDR;
+        }
+    }
+    pwm_show(0);
+}
+
+
+// split pwm_row into the back set of planes, dithering between the two nearest grey levels
+static void __not_in_flash_func(pwm_split_row)(int y)
+{
+    const uint8_t *th = dm_row(8, y);
+    unsigned int th_mask = dm_rows[8].stride - 1;
+
+    for (int x = 0; x < SCREENWIDTH; x += 32)
+    {
+        uint32_t words[EL_PWM_PLANES] = {0};
+
+        for (int i = 0; i < 32; i++)
+        {
+            uint32_t e = pwm_lut[pwm_row[x + i]];
+            uint32_t m = (e & 0xff) >= th[(x + i) & th_mask] ? e >> 16 : (e >> 8) & 0xff;
+
+            for (int p = 0; p < EL_PWM_PLANES; p++)
+            {
+                words[p] = (words[p] >> 1) | ((m >> p) << 31);
+            }
+        }
+        for (int p = 0; p < EL_PWM_PLANES; p++)
+        {
+            *(uint32_t *)&pwm_planes[back_1b][p].bits[y * EL_DISP_STRIDE + (x >> 3)] = words[p];
+        }
+    }
+}
+#endif
 
 
 static void scanline_func_none(int scanline)
 {
+#if EL_PWM_PLANES
+    memset(pwm_row, 0, SCREENWIDTH);
+#else
     memset(&frame_buffer_1b[scanline * EL_DISP_STRIDE], 0, EL_DISP_STRIDE);
+#endif
 }
 
 
@@ -139,6 +421,19 @@ static void scanline_func_single(int scanline)
 {
     uint8_t *src;
 
+#if EL_DIRECT_1B
+    if (display_frame_direct && scanline < MAIN_VIEWHEIGHT)
+    {
+        if ((scanline >> 3) != direct_rows_block)
+        {
+            convert_direct_rows(scanline);
+            direct_rows_block = scanline >> 3;
+        }
+        memcpy(&frame_buffer_1b[(scanline + EL_VIEW_Y) * EL_DISP_STRIDE],
+               direct_rows + (scanline & 7) * EL_DISP_STRIDE, EL_DISP_STRIDE);
+        return;
+    }
+#endif
     if (scanline < MAIN_VIEWHEIGHT)
     {
         src = frame_buffer[display_frame_index] + scanline * SCREENWIDTH;
@@ -157,28 +452,38 @@ static void scanline_func_single(int scanline)
         src[0] = video_scroll[scanline];
     }
 #endif
+#if EL_PWM_PLANES
+    for (int i = 0; i < SCREENWIDTH; i++)
+    {
+        pwm_row[i] = palette[src[i]];
+    }
+#else
     uint8_t *dst = &frame_buffer_1b[(scanline + 28) * EL_DISP_STRIDE];
 
-    for (int pid = 0; pid < SCREENWIDTH; pid += 8)
-    {
-        uint8_t bt = 0;
+    dither_engine->scanline((uint32_t *)dst, src, palette, scanline + 28, display_frame_index,
+                            scanline != last_converted_row + 1);
+    last_converted_row = scanline;
+#endif
+}
 
-        for (int i = 0; i < 8; i++)
-        {
-            uint8_t sp = *(src + pid + i);
-            sp = palette[sp];            
-            PUT_1B_PIXEL(pid + i, scanline + 28, sp, display_frame_index ? 4 : 8);
-        }
-    }
+
+// an old screen row during a wipe (see wipe_linelookup)
+static inline const uint8_t *wipe_old_row(int row)
+{
+#if PICO_ON_DEVICE
+    return (const uint8_t *)wipe_linelookup[row];
+#else
+    return &frame_buffer[0][0] + wipe_linelookup[row];
+#endif
 }
 
 
+// the wipe is drawn a run at a time, a run being adjacent columns that have melted by the same amount (see
+// build_wipe_runs), so each run either takes a span of the new screen row or a span of a single old screen row
 static void scanline_func_wipe(int scanline)
 {
-    static const uint8_t *dmap = dither_maps[8].map;
-    static const uint8_t dsize = dither_maps[8].size;
-
     const uint8_t *src;
+    const uint8_t *lum = palette;
     
     if (scanline < MAIN_VIEWHEIGHT)
     {
@@ -190,37 +495,147 @@ static void scanline_func_wipe(int scanline)
     }
 
     assert(wipe_yoffsets && wipe_linelookup);
-    uint8_t *dst = &frame_buffer_1b[(scanline + 28) * EL_DISP_STRIDE];
-
     src += scanline * SCREENWIDTH;
-    
-    for (int i = 0; i < SCREENWIDTH; i++)
+#if EL_PWM_PLANES
+    uint8_t *dst = pwm_row;
+#else
+    uint32_t *dst = (uint32_t *)&frame_buffer_1b[(scanline + 28) * EL_DISP_STRIDE];
+    const uint8_t *th = dm_row(8, scanline);
+    unsigned int th_mask = dm_rows[8].stride - 1;
+    uint32_t new_bits[SCREENWIDTH / 32];
+    uint32_t bits = 0;
+
+    // rows above the lowest melted column show some of the new screen, which is thresholded a word at a time
+    // against the same map as the old screen
+    if (scanline < wipe_max)
+    {
+        el_dither_engines[EL_DITHER_ORDERED].scanline(new_bits, src, lum, scanline, 0, true);
+    }
+#endif
+
+    for (int r = 0; r < wipe_num_runs; r++)
     {
-        int rel = scanline - wipe_yoffsets[i];
-        uint8_t sp;
-   
+        int x0 = wipe_run_x[r];
+        int x1 = wipe_run_x[r + 1];
+        int rel = scanline - wipe_yoffsets[x0];
+        const uint8_t *old = NULL;
+
+        if (rel >= 0)
+        {
+            old = wipe_old_row(rel);
+            // todo better protection here
+            if (old < &frame_buffer[0][0] || old >= &frame_buffer[0][0] + 2 * SCREENWIDTH * MAIN_VIEWHEIGHT)
+            {
+                old = NULL;
+            }
+        }
+#if EL_PWM_PLANES
         if (rel < 0)
         {
-            sp = palette[src[i]];
-            dst[i >> 3] |= (sp >= dmap[(scanline & (dsize - 1)) * dsize + (i & (dsize - 1))] ? 1 : 0) << (i & 7);
+            for (int x = x0; x < x1; x++)
+            {
+                dst[x] = lum[src[x]];
+            }
+        }
+        else if (old)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                dst[x] = lum[old[x]];
+            }
         }
         else
         {
-            const uint8_t *flip;
-            flip = (const uint8_t*)wipe_linelookup[rel];
-
-            // todo better protection here
-            if (flip >= &frame_buffer[0][0] && flip < &frame_buffer[0][0] + 2 * SCREENWIDTH * MAIN_VIEWHEIGHT)
+            memset(dst + x0, 0, x1 - x0);
+        }
+#else
+        if (rel < 0)
+        {
+            bits |= new_bits[x0 >> 5] & (~0u << (x0 & 31)) & (~0u >> (31 - ((x1 - 1) & 31)));
+        }
+        else if (old)
+        {
+            // as threshold_32px, the sign bit of th - 1 - lum is the pixel
+            for (int x = x0; x < x1; x++)
             {
-                sp = palette[flip[i]];
-                dst[i >> 3] |= (sp >= dmap[(scanline & (dsize - 1)) * dsize + (i & (dsize - 1))] ? 1 : 0) << (i & 7);
+                bits |= (((uint32_t)th[x & th_mask] - 1u - lum[old[x]]) & 0x80000000u) >> (31 - (x & 31));
             }
         }
+        // runs never straddle a word, so the whole word is known at the end of the last run in it
+        if (!(x1 & 31))
+        {
+            dst[(x1 - 1) >> 5] = bits;
+            bits = 0;
+        }
+#endif
     }
 }
 
 
-static inline uint draw_vpatch(patch_t *patch, vpatchlist_t *vp, uint off, int scanline)
+// split the columns into runs that have melted by the same amount, breaking them every 32 columns so that each run is
+// within one word of the 1-bit row
+static void build_wipe_runs(void)
+{
+    int n = 0;
+    int max = 0;
+
+    for (int x = 0; x < SCREENWIDTH; x++)
+    {
+        if (!(x & 31) || wipe_yoffsets[x] != wipe_yoffsets[x - 1])
+        {
+            wipe_run_x[n++] = x;
+        }
+        if (wipe_yoffsets[x] > max)
+        {
+            max = wipe_yoffsets[x];
+        }
+    }
+    assert(n <= WIPE_MAX_RUNS);
+    wipe_run_x[n] = SCREENWIDTH;
+    wipe_num_runs = n;
+    wipe_max = max;
+}
+
+
+// pixels covered by an overlay entry, including repeats
+static inline int vpatch_span(patch_t *patch, const vpatchlist_t *vp)
+{
+    int w = vpatch_width(patch);
+    int repeat = vp->entry.repeat;
+
+    if (repeat && vp->entry.patch_handle == VPATCH_M_THERMM)
+    {
+        return w + repeat * (w - 1); // see the hack below
+    }
+    return w + repeat * w;
+}
+
+
+#if !EL_PWM_PLANES
+// copy n bits of row from bit from to bit to, a destination word at a time; the ranges must not overlap
+static inline void row_copy_bits(uint32_t *row, int to, int from, int n)
+{
+    while (n > 0)
+    {
+        int chunk = MIN(n, 32 - (to & 31));
+        uint32_t bits = row[from >> 5] >> (from & 31);
+
+        if ((from & 31) + chunk > 32)
+        {
+            bits |= row[(from >> 5) + 1] << (32 - (from & 31));
+        }
+        uint32_t m = (chunk == 32 ? ~0u : (1u << chunk) - 1) << (to & 31);
+        row[to >> 5] = (row[to >> 5] & ~m) | ((bits << (to & 31)) & m);
+        to += chunk;
+        from += chunk;
+        n -= chunk;
+    }
+}
+#endif
+
+
+// decode one row of a vpatch into ov_val/ov_mask (pwm_row with EL_PWM_PLANES), returning the new data offset
+static inline uint decode_vpatch_row(patch_t *patch, vpatchlist_t *vp, uint off, int scanline)
 {
     int repeat = vp->entry.repeat;
     int w = vpatch_width(patch);
@@ -420,7 +835,7 @@ static inline uint draw_vpatch(patch_t *patch, vpatchlist_t *vp, uint off, int s
     else
     {
         uint sp = vpatch_shared_palette(patch);
-        uint8_t *pal16 = shared_pal[sp];
+        const uint8_t *pal16 = shared_pal[sp];
         assert(sp < NUM_SHARED_PALETTES);
         switch (vpatch_type(patch))
         {
@@ -480,149 +895,520 @@ static inline uint draw_vpatch(patch_t *patch, vpatchlist_t *vp, uint off, int s
     }
     if (repeat)
     {
-        uint16_t px = vp->entry.x;
-        uint16_t py = scanline;
+        int px = vp->entry.x;
         // we need them to be solid... which they are, but if not you'll just get some visual funk
         //assert(vpatch_type(patch) == vp4_solid);
         if (vp->entry.patch_handle == VPATCH_M_THERMM)
         {
             w--; // hackity hack
         }
-        
-        for (int i=0;i<repeat*w;i++)
+
+#if EL_PWM_PLANES
+        for (int i = 0; i < repeat * w && px + w + i < SCREENWIDTH; i++)
+        {
+            pwm_row[px + w + i] = pwm_row[px + i];
+        }
+#else
+        // dest[w + i] = dest[i] for i < repeat * w, but copying what is done so far each time, so the
+        // copies double in size
+        int total = MIN(w + repeat * w, SCREENWIDTH - px);
+
+        for (int done = w; done < total;)
         {
-            /* TODO ? */
-            // dest[w+i] = dest[i];
+            int n = MIN(done, total - done);
 
-            // PUT_1B_PIXEL(px, py + 28, pal16[v & 0xf], 1);
+            row_copy_bits(ov_val, px + done, px, n);
+            row_copy_bits(ov_mask, px + done, px, n);
+            done += n;
         }
+#endif
     }
 
     return data - data0;
 }
 
 
-void new_frame_init_overlays_palette_and_wipe(void)
+#if !EL_PWM_PLANES
+// clear the ov_val/ov_mask words covered by an overlay entry, and return the first and (exclusive) last one
+static inline void clear_overlay_words(patch_t *patch, const vpatchlist_t *vp, int *first, int *end)
 {
-    // re-initialize our overlay drawing
-    if (display_video_type >= FIRST_VIDEO_TYPE_WITH_OVERLAYS)
+    *first = vp->entry.x >> 5;
+    *end = MIN((vp->entry.x + vpatch_span(patch, vp) + 31) >> 5, OV_ROW_WORDS);
+    for (int i = *first; i < *end; i++)
     {
-        memset(vpatchlists->vpatch_next, 0, sizeof(vpatchlists->vpatch_next));
-        memset(vpatchlists->vpatch_starters, 0, sizeof(vpatchlists->vpatch_starters));
-        memset(vpatchlists->vpatch_doff, 0, sizeof(vpatchlists->vpatch_doff));
-        vpatchlist_t *overlays = vpatchlists->overlays[display_overlay_index];
-        // do it in reverse so our linked lists are in ascending order
-        for (int i = overlays->header.size - 1; i > 0; i--)
-        {
-            assert(overlays[i].entry.y < count_of(vpatchlists->vpatch_starters));
-            vpatchlists->vpatch_next[i] = vpatchlists->vpatch_starters[overlays[i].entry.y];
-            vpatchlists->vpatch_starters[overlays[i].entry.y] = i;
-        }
-        if (next_pal != -1)
-        {
-            static const uint8_t *playpal;
-            static bool calculate_palettes;
-            if (!playpal)
-            {
-                lumpindex_t l = W_GetNumForName("PLAYPAL");
-                playpal = W_CacheLumpNum(l, PU_STATIC);
-                calculate_palettes = W_LumpLength(l) == 768;
-            }
-            if (!calculate_palettes || !next_pal)
-            {
-                const uint8_t *doompalette = playpal + next_pal * 768;
+        ov_val[i] = ov_mask[i] = 0;
+    }
+}
 
-                for (int i = 0; i < 256; i++)
-                {
-                    int r = *doompalette++;
-                    int g = *doompalette++;
-                    int b = *doompalette++;
-                    if (usegamma) {
-                        r = gammatable[usegamma-1][r];
-                        g = gammatable[usegamma-1][g];
-                        b = gammatable[usegamma-1][b];
-                    }
-                    
-                /* Desaturating and adding some contrast */
-                /* TODO: it needs adjustments */
-                    uint16_t pp = (r + g + b) * 341 >> 10;
-                    pp <<= 1;
-                    palette[i] = MIN(255, pp);
 
-                    if (display_video_type != VIDEO_TYPE_WIPE)
-                    {
-                        /* HACK: max out reds to make the UI visible */
-                        if ((r >= 140) && ((g + b) <= 60))
-                        {
-                            palette[i] = 255;
-                        }
-                    }
+static inline void merge_overlay_words(int scanline, const uint32_t *val, const uint32_t *mask, int first, int end)
+{
+    uint32_t *dst = (uint32_t *)&frame_buffer_1b[(scanline + 28) * EL_DISP_STRIDE];
 
-                }
-            }
-            else
-            {
-                int mul, r0, g0, b0;
-                
-                if (next_pal < 9)
-                {
-                    mul = next_pal * 65536 / 9;
-                    r0 = 255; g0 = b0 = 0;
-                }
-                else if (next_pal < 13)
-                {
-                    mul = (next_pal - 8) * 65536 / 8;
-                    r0 = 215; g0 = 186; b0 = 69;
-                }
-                else
-                {
-                    mul = 65536 / 8;
-                    r0 = b0 = 0; g0 = 256;
-                }
-                
-                const uint8_t *doompalette = playpal;
-                
-                for (int i = 0; i < 256; i++)
-                {
-                    int r = *doompalette++;
-                    int g = *doompalette++;
-                    int b = *doompalette++;
-                    r += ((r0 - r) * mul) >> 16;
-                    g += ((g0 - g) * mul) >> 16;
-                    b += ((b0 - b) * mul) >> 16;
-                
-                /* Desaturating */
-                    uint16_t pp = (r + g + b) * 341 >> 10;
+    end = MIN(end, EL_DISP_STRIDE / 4);
+    for (int i = first; i < end; i++)
+    {
+        dst[i] = (dst[i] & ~mask[i - first]) | val[i - first];
+    }
+}
+#endif
 
-                    palette[i] = (uint8_t)pp;
-                }
-            }
 
-            next_pal = -1;
-            assert(vpatch_type(stbar) == vp4_solid); // no transparent, no runs, 4 bpp
-            
-            for (int i = 0; i < NUM_SHARED_PALETTES; i++)
-            {
-                patch_t *patch = resolve_vpatch_handle(vpatch_for_shared_palette[i]);
-                assert(vpatch_colorcount(patch) <= 16);
-                assert(vpatch_has_shared_palette(patch));
-                for (int j = 0; j < 16; j++)
-                {
-                    shared_pal[i][j] = palette[vpatch_palette(patch)[j]];
-                }
-            }
-        }
+static inline uint draw_vpatch(patch_t *patch, vpatchlist_t *vp, uint off, int scanline)
+{
+#if EL_PWM_PLANES
+    return decode_vpatch_row(patch, vp, off, scanline);
+#else
+    int first, end;
 
-        if (display_video_type == VIDEO_TYPE_WIPE)
-        {
-//            printf("WIPEMIN %d\n", wipe_min);
-            if (wipe_min <= 200)
-            {
-                bool regular = display_overlay_index; // just happens to toggle every frame
-                int new_wipe_min = 200;
-                for (int i = 0; i < SCREENWIDTH; i++)
-                {
-                    int v;
+    clear_overlay_words(patch, vp, &first, &end);
+    off = decode_vpatch_row(patch, vp, off, scanline);
+    merge_overlay_words(scanline, ov_val + first, ov_mask + first, first, end);
+    return off;
+#endif
+}
+
+
+#if EL_OVERLAY_CACHE
+// overlays are mostly the same from frame to frame (status bar numbers, HUD text, menus), so whole overlay entries
+// are kept pre-dithered as the ov_val/ov_mask words of each of their rows. the key is the entry (patch, position and
+// repeat, so the dither phase is fixed) and the dither map; the cache is emptied when the palette changes
+typedef struct
+{
+    uint32_t key;           // the vpatchlist_t entry
+    uint8_t dm_id;
+    uint8_t first;          // first row word covered
+    uint8_t words;          // row words covered
+    uint8_t height;
+    // followed by height rows of words val words then words mask words
+} ov_cache_entry_t;
+
+#define OV_CACHE_WORDS (EL_OVERLAY_CACHE_BYTES / 4)
+#define OV_CACHE_HASH_SIZE 64 // power of 2
+#define OV_CACHE_MAX_ENTRY_WORDS (OV_CACHE_WORDS / 4) // bigger patches (menu titles etc) are decoded every time
+
+static uint32_t ov_cache[OV_CACHE_WORDS];
+static uint16_t ov_cache_used;                          // words of ov_cache in use
+static uint16_t ov_cache_hash[OV_CACHE_HASH_SIZE];      // word offset + 1 of an entry, 0 if empty
+static uint8_t ov_cache_count;
+static uint16_t ov_cache_for[VPATCHLIST_COUNT_OVERLAY]; // per display overlay: word offset + 1 of its entry, or 0
+
+
+static void ov_cache_flush(void)
+{
+    ov_cache_used = 0;
+    ov_cache_count = 0;
+    memset(ov_cache_hash, 0, sizeof(ov_cache_hash));
+}
+
+
+static inline uint32_t ov_cache_entry_key(const vpatchlist_t *vp)
+{
+    uint32_t key;
+    memcpy(&key, vp, sizeof(key));
+    return key;
+}
+
+
+static inline unsigned int ov_cache_slot(uint32_t key, int dm_id)
+{
+    return ((key ^ dm_id) * 0x9e3779b1u) >> (32 - __builtin_ctz(OV_CACHE_HASH_SIZE));
+}
+
+
+static uint16_t ov_cache_find(const vpatchlist_t *vp, int dm_id)
+{
+    uint32_t key = ov_cache_entry_key(vp);
+
+    for (unsigned int slot = ov_cache_slot(key, dm_id); ov_cache_hash[slot]; slot = (slot + 1) & (OV_CACHE_HASH_SIZE - 1))
+    {
+        const ov_cache_entry_t *e = (const ov_cache_entry_t *)&ov_cache[ov_cache_hash[slot] - 1];
+
+        if (e->key == key && e->dm_id == dm_id)
+        {
+            return ov_cache_hash[slot];
+        }
+    }
+    return 0;
+}
+
+
+// decode every row of the entry into the cache; returns 0 if it isn't cached, with no_room set if that is only
+// because the cache is full
+static uint16_t ov_cache_add(vpatchlist_t *vp, int dm_id, bool *no_room)
+{
+    static_assert(sizeof(ov_cache_entry_t) % 4 == 0, "");
+    patch_t *patch = resolve_vpatch_handle(vp->entry.patch_handle);
+    int h = vpatch_height(patch);
+    int first, end;
+
+    *no_room = false;
+    if (vp->entry.y + h > SCREENHEIGHT)
+    {
+        return 0;
+    }
+    clear_overlay_words(patch, vp, &first, &end);
+    unsigned int words = sizeof(ov_cache_entry_t) / 4 + h * (end - first) * 2;
+    if (words > OV_CACHE_MAX_ENTRY_WORDS)
+    {
+        return 0;
+    }
+    // keep the hash table no more than 3/4 full
+    if (ov_cache_used + words > OV_CACHE_WORDS || ov_cache_count >= OV_CACHE_HASH_SIZE * 3 / 4)
+    {
+        *no_room = true;
+        return 0;
+    }
+
+    uint16_t offset = ov_cache_used;
+    ov_cache_entry_t *e = (ov_cache_entry_t *)&ov_cache[offset];
+    uint32_t *rows = (uint32_t *)(e + 1);
+    uint off = 0;
+
+    e->key = ov_cache_entry_key(vp);
+    e->dm_id = dm_id;
+    e->first = first;
+    e->words = end - first;
+    e->height = h;
+    for (int y = 0; y < h; y++)
+    {
+        if (y)
+        {
+            clear_overlay_words(patch, vp, &first, &end);
+        }
+        off = decode_vpatch_row(patch, vp, off, vp->entry.y + y);
+        memcpy(rows, ov_val + first, e->words * 4);
+        memcpy(rows + e->words, ov_mask + first, e->words * 4);
+        rows += e->words * 2;
+    }
+    ov_cache_used += words;
+    ov_cache_count++;
+
+    unsigned int slot = ov_cache_slot(e->key, dm_id);
+    while (ov_cache_hash[slot])
+    {
+        slot = (slot + 1) & (OV_CACHE_HASH_SIZE - 1);
+    }
+    ov_cache_hash[slot] = offset + 1;
+    return offset + 1;
+}
+
+
+// find (or add) the cache entry for each overlay in the display list. if the cache fills up it is emptied once and
+// refilled from this frame's overlays; whatever still doesn't fit is decoded row by row as before
+static void assign_overlay_cache(vpatchlist_t *overlays)
+{
+    int dm_id = display_frame_index ? 3 : 8;
+    bool flushed = false;
+
+    for (int i = 1; i < overlays->header.size; i++)
+    {
+        uint16_t e = ov_cache_find(&overlays[i], dm_id);
+
+        if (!e)
+        {
+            bool no_room;
+
+            e = ov_cache_add(&overlays[i], dm_id, &no_room);
+            if (no_room && !flushed)
+            {
+                // the entries found so far have gone too, so start again
+                ov_cache_flush();
+                flushed = true;
+                i = 0;
+                continue;
+            }
+        }
+        ov_cache_for[i] = e;
+    }
+}
+
+
+static inline void draw_cached_vpatch(uint16_t entry, int yoff, int scanline)
+{
+    const ov_cache_entry_t *e = (const ov_cache_entry_t *)&ov_cache[entry - 1];
+    const uint32_t *row = (const uint32_t *)(e + 1) + yoff * e->words * 2;
+
+    merge_overlay_words(scanline, row, row + e->words, e->first, e->first + e->words);
+}
+#endif
+
+
+// advance over one row of vpatch data without drawing it (the row in frame_buffer_1b is already up to date)
+static uint skip_vpatch_row(patch_t *patch, uint off)
+{
+    int w = vpatch_width(patch);
+    const uint8_t *data0 = vpatch_data(patch);
+    const uint8_t *data = data0 + off;
+
+    switch (vpatch_type(patch))
+    {
+    case vp4_solid:
+    case vp4_alpha:
+        data += (w + 1) / 2;
+        break;
+    case vp_border:
+        data += 2;
+        break;
+    case vp4_runs:
+    case vp6_runs:
+    case vp8_runs:
+    {
+        int px = 0;
+        uint8_t gap;
+
+        while (0xff != (gap = *data++))
+        {
+            px += gap;
+            int len = *data++;
+            if (vpatch_type(patch) == vp4_runs)
+            {
+                data += (len + 1) / 2;
+            }
+            else if (vpatch_type(patch) == vp6_runs)
+            {
+                data += (len / 4) * 3 + (len & 3);
+            }
+            else
+            {
+                data += len;
+            }
+            px += len;
+            assert(px <= w);
+            if (px == w)
+            {
+                break;
+            }
+        }
+        break;
+    }
+    default:
+        assert(false);
+        break;
+    }
+    return data - data0;
+}
+
+
+static inline bool row_is_dirty(int scanline)
+{
+    return (dirty_rows[back_1b][scanline >> 5] >> (scanline & 31)) & 1;
+}
+
+
+static inline void mark_all_rows_dirty(void)
+{
+    memset(dirty_rows, 0xff, sizeof(dirty_rows));
+}
+
+
+static inline void mark_row_dirty(int scanline)
+{
+    for (int b = 0; b < NUM_1B_BUFFERS; b++)
+    {
+        dirty_rows[b][scanline >> 5] |= 1u << (scanline & 31);
+    }
+}
+
+
+// order dependent hash of the overlay entries covering this row (an entry identifies the patch, its position and
+// repeat, so if this matches what was last drawn, so do the overlay pixels)
+static uint32_t overlay_row_signature(const vpatchlist_t *overlays, int scanline)
+{
+    uint32_t sig = 0;
+
+    for (int vp = vpatchlists->vpatch_next[0]; vp; vp = vpatchlists->vpatch_next[vp])
+    {
+        patch_t *patch = resolve_vpatch_handle(overlays[vp].entry.patch_handle);
+
+        if (scanline - overlays[vp].entry.y < vpatch_height(patch))
+        {
+            uint32_t e;
+            memcpy(&e, &overlays[vp], sizeof(e));
+            sig = (sig ^ e) * 0x01000193u;
+        }
+    }
+    return sig;
+}
+
+
+// brightness curve applied to the desaturated palette, l and the result are 0-255
+static uint8_t contrast(int curve, int l)
+{
+    switch (curve)
+    {
+    case EL_CONTRAST_DOUBLE:
+        return MIN(255, l * 2);
+    case EL_CONTRAST_S_CURVE:
+        // smoothstep, 3l^2 - 2l^3
+        return l * l * (765 - 2 * l) / 65025;
+    case EL_CONTRAST_LIFT:
+        // inverted square, for shadow detail
+        return 255 - (255 - l) * (255 - l) / 255;
+    default:
+        return l;
+    }
+}
+
+
+static void build_grey_palette(grey_palette_t *gp, int pal, bool wipe)
+{
+    static const uint8_t *playpal;
+    static bool calculate_palettes;
+    if (!playpal)
+    {
+        lumpindex_t l = W_GetNumForName("PLAYPAL");
+        playpal = W_CacheLumpNum(l, PU_STATIC);
+        calculate_palettes = W_LumpLength(l) == 768;
+    }
+    if (!calculate_palettes || !pal)
+    {
+        const uint8_t *doompalette = playpal + pal * 768;
+
+        for (int i = 0; i < 256; i++)
+        {
+            int r = *doompalette++;
+            int g = *doompalette++;
+            int b = *doompalette++;
+            if (usegamma) {
+                r = gammatable[usegamma-1][r];
+                g = gammatable[usegamma-1][g];
+                b = gammatable[usegamma-1][b];
+            }
+
+            /* Desaturating and adding some contrast */
+            gp->lum[i] = contrast(EL_CONTRAST_DEFAULT, (r + g + b) * 341 >> 10);
+
+            if (!wipe)
+            {
+                /* HACK: max out reds to make the UI visible */
+                if ((r >= 140) && ((g + b) <= 60))
+                {
+                    gp->lum[i] = 255;
+                }
+            }
+        }
+    }
+    else
+    {
+        int mul, r0, g0, b0;
+
+        if (pal < 9)
+        {
+            mul = pal * 65536 / 9;
+            r0 = 255; g0 = b0 = 0;
+        }
+        else if (pal < 13)
+        {
+            mul = (pal - 8) * 65536 / 8;
+            r0 = 215; g0 = 186; b0 = 69;
+        }
+        else
+        {
+            mul = 65536 / 8;
+            r0 = b0 = 0; g0 = 256;
+        }
+
+        const uint8_t *doompalette = playpal;
+
+        for (int i = 0; i < 256; i++)
+        {
+            int r = *doompalette++;
+            int g = *doompalette++;
+            int b = *doompalette++;
+            r += ((r0 - r) * mul) >> 16;
+            g += ((g0 - g) * mul) >> 16;
+            b += ((b0 - b) * mul) >> 16;
+
+            /* Desaturating */
+            gp->lum[i] = contrast(EL_TINT_CONTRAST_DEFAULT, (r + g + b) * 341 >> 10);
+        }
+    }
+
+    assert(vpatch_type(stbar) == vp4_solid); // no transparent, no runs, 4 bpp
+
+    for (int i = 0; i < NUM_SHARED_PALETTES; i++)
+    {
+        patch_t *patch = resolve_vpatch_handle(vpatch_for_shared_palette[i]);
+        assert(vpatch_colorcount(patch) <= 16);
+        assert(vpatch_has_shared_palette(patch));
+        for (int j = 0; j < 16; j++)
+        {
+            gp->shared[i][j] = gp->lum[vpatch_palette(patch)[j]];
+        }
+    }
+}
+
+
+// the greyscale version of a PLAYPAL palette at the current gamma, built the first time it is asked for
+static const grey_palette_t *grey_palette(int pal, bool wipe)
+{
+    assert(pal >= 0 && pal < NUM_PLAYPALS);
+#if !EL_GREY_PALETTE_CACHE
+    build_grey_palette(&grey_palettes[0], pal, wipe);
+    return &grey_palettes[0];
+#else
+    int slot = wipe ? GREY_WIPE_SLOT : pal;
+
+    if (grey_gamma != usegamma)
+    {
+        memset(grey_slot_pal, -1, sizeof(grey_slot_pal));
+        grey_gamma = usegamma;
+    }
+    if (grey_slot_pal[slot] != pal)
+    {
+        build_grey_palette(&grey_palettes[slot], pal, wipe);
+        grey_slot_pal[slot] = pal;
+    }
+    return &grey_palettes[slot];
+#endif
+}
+
+
+void new_frame_init_overlays_palette_and_wipe(void)
+{
+    // re-initialize our overlay drawing
+    if (display_video_type >= FIRST_VIDEO_TYPE_WITH_OVERLAYS)
+    {
+        memset(vpatchlists->vpatch_next, 0, sizeof(vpatchlists->vpatch_next));
+        memset(vpatchlists->vpatch_starters, 0, sizeof(vpatchlists->vpatch_starters));
+        memset(vpatchlists->vpatch_doff, 0, sizeof(vpatchlists->vpatch_doff));
+        vpatchlist_t *overlays = vpatchlists->overlays[display_overlay_index];
+        // do it in reverse so our linked lists are in ascending order
+        for (int i = overlays->header.size - 1; i > 0; i--)
+        {
+            assert(overlays[i].entry.y < count_of(vpatchlists->vpatch_starters));
+            vpatchlists->vpatch_next[i] = vpatchlists->vpatch_starters[overlays[i].entry.y];
+            vpatchlists->vpatch_starters[overlays[i].entry.y] = i;
+        }
+        if (next_pal != -1)
+        {
+            const grey_palette_t *gp = grey_palette(next_pal, display_video_type == VIDEO_TYPE_WIPE);
+
+            palette = gp->lum;
+            shared_pal = gp->shared;
+            el_lum_palette = gp->lum;
+            next_pal = -1;
+            mark_all_rows_dirty();
+#if EL_OVERLAY_CACHE
+            ov_cache_flush();
+#endif
+        }
+#if EL_OVERLAY_CACHE
+        assign_overlay_cache(overlays);
+#endif
+
+        if (display_video_type == VIDEO_TYPE_WIPE)
+        {
+//            printf("WIPEMIN %d\n", wipe_min);
+            // the wipe is stepped each pass, and with EL_PWM_PLANES a pass is a whole cycle of planes
+            for (int step = 0; step < WIPE_STEPS_PER_PASS && wipe_min <= 200; step++)
+            {
+                bool regular = display_overlay_index; // just happens to toggle every frame
+                int new_wipe_min = 200;
+                for (int i = 0; i < SCREENWIDTH; i++)
+                {
+                    int v;
                     if (wipe_yoffsets_raw[i] < 0)
                     {
                         if (regular)
@@ -654,6 +1440,7 @@ void new_frame_init_overlays_palette_and_wipe(void)
                 assert(new_wipe_min >= wipe_min);
                 wipe_min = new_wipe_min;
             }
+            build_wipe_runs();
         }
     }
 }
@@ -664,12 +1451,34 @@ void new_frame_stuff(void)
 {
     if (sem_available(&render_frame_ready)) {
         sem_acquire_blocking(&render_frame_ready);
+        bool new_source = next_video_type != display_video_type || next_frame_index != display_frame_index;
+#if EL_DIRECT_1B
+        new_source |= next_frame_direct != display_frame_direct;
+#endif
+        if (new_source)
+        {
+            mark_all_rows_dirty();
+        }
+        for (int i = 0; i < DIRTY_ROW_WORDS; i++)
+        {
+            for (int b = 0; b < NUM_1B_BUFFERS; b++)
+            {
+                dirty_rows[b][i] |= next_dirty_rows[i];
+            }
+        }
         display_video_type = next_video_type;
         display_frame_index = next_frame_index;
         display_overlay_index = next_overlay_index;
+#if EL_DIRECT_1B
+        display_frame_direct = next_frame_direct;
+#endif
 
 #if !DEMO1_ONLY
         video_scroll = next_video_scroll; // todo does this waste too much space
+        if (video_scroll)
+        {
+            mark_all_rows_dirty();
+        }
 #endif
         sem_release(&display_frame_freed);
     
@@ -691,15 +1500,50 @@ void new_frame_stuff(void)
 
 void draw_1b_buffer(void)
 {
+#if EL_PWM_PLANES
+    // the planes keep being shown without us, so there is only work to do when something has changed
+    if (!sem_available(&render_frame_ready) && display_video_type != VIDEO_TYPE_WIPE && next_pal == -1
+#if !DEMO1_ONLY
+        && !video_scroll
+#endif
+        )
+    {
+        return;
+    }
+#endif
+
+#if EL_DOUBLE_1B && PICO_ON_DEVICE
+    // if the last pass took longer than a frame, the old front buffer (now the back one) may still be going out
+    uintptr_t dma_addr = dma_hw->ch[dma_chan].read_addr;
+    if (dma_addr >= (uintptr_t)&frames_1b[back_1b] && dma_addr <= (uintptr_t)&frames_1b[back_1b + 1])
+    {
+        return;
+    }
+#elif EL_PWM_PLANES && PICO_ON_DEVICE
+    // the back set is still the one being shown until the current cycle ends
+    if (pwm_next_set >= 0)
+    {
+        return;
+    }
+#endif
 
+    EL_TIME_START(t_new_frame);
     new_frame_stuff();
+    EL_TIME_END(EL_TIME_NEW_FRAME, t_new_frame);
+#if EL_DIRECT_1B
+    direct_rows_block = -1;
+#endif
+    last_converted_row = -2;
+    bool diffuse_dirty = false;
 
     for (int scanline = 0; scanline < SCREENHEIGHT; scanline++)
     {
         if (display_video_type != VIDEO_TYPE_TEXT)
-        {            
-            scanline_funcs[display_video_type](scanline);
-            
+        {
+            // the wipe moves every pass
+            bool dirty = display_video_type == VIDEO_TYPE_WIPE || row_is_dirty(scanline);
+            vpatchlist_t *overlays = vpatchlists->overlays[display_overlay_index];
+
             if (display_video_type >= FIRST_VIDEO_TYPE_WITH_OVERLAYS)
             {
                 assert(scanline < count_of(vpatchlists->vpatch_starters));
@@ -722,8 +1566,34 @@ void draw_1b_buffer(void)
                     vp = next;
                 }
 
-                vpatchlist_t *overlays = vpatchlists->overlays[display_overlay_index];
-                prev = 0;
+                // a changed overlay needs the row underneath it redrawn too
+                uint32_t sig = overlay_row_signature(overlays, scanline);
+                if (sig != overlay_row_sig[scanline])
+                {
+                    overlay_row_sig[scanline] = sig;
+                    mark_row_dirty(scanline);
+                    dirty = true;
+                }
+            }
+
+            // with error diffusion, a changed row changes every row converted after it
+            if (dither_engine->diffuses)
+            {
+                dirty |= diffuse_dirty;
+                diffuse_dirty = dirty;
+            }
+
+            if (dirty)
+            {
+                EL_TIME_START(t_base);
+                scanline_funcs[display_video_type](scanline);
+                EL_TIME_END(EL_TIME_BASE, t_base);
+            }
+            
+            if (display_video_type >= FIRST_VIDEO_TYPE_WITH_OVERLAYS)
+            {
+                EL_TIME_START(t_overlays);
+                int prev = 0;
                 
                 for (int vp = vpatchlists->vpatch_next[prev]; vp; vp = vpatchlists->vpatch_next[prev])
                 {
@@ -732,8 +1602,25 @@ void draw_1b_buffer(void)
                     
                     if (yoff < vpatch_height(patch))
                     {
-                        vpatchlists->vpatch_doff[vp] = draw_vpatch(patch, &overlays[vp],
-                                                                   vpatchlists->vpatch_doff[vp], scanline);
+#if EL_OVERLAY_CACHE
+                        if (ov_cache_for[vp])
+                        {
+                            if (dirty)
+                            {
+                                draw_cached_vpatch(ov_cache_for[vp], yoff, scanline);
+                            }
+                        }
+                        else
+#endif
+                        if (dirty)
+                        {
+                            vpatchlists->vpatch_doff[vp] = draw_vpatch(patch, &overlays[vp],
+                                                                       vpatchlists->vpatch_doff[vp], scanline);
+                        }
+                        else
+                        {
+                            vpatchlists->vpatch_doff[vp] = skip_vpatch_row(patch, vpatchlists->vpatch_doff[vp]);
+                        }
                         prev = vp;
                     }
                     else
@@ -741,10 +1628,35 @@ void draw_1b_buffer(void)
                         vpatchlists->vpatch_next[prev] = vpatchlists->vpatch_next[vp];
                     }
                 }
+                EL_TIME_END(EL_TIME_OVERLAYS, t_overlays);
+            }
+#if EL_PWM_PLANES
+            if (dirty)
+            {
+                EL_TIME_START(t_split);
+                pwm_split_row(scanline + 28);
+                EL_TIME_END(EL_TIME_PWM_SPLIT, t_split);
             }
+#endif
         }
 
     }
+    memset(dirty_rows[back_1b], 0, sizeof(dirty_rows[back_1b]));
+
+#if EL_DOUBLE_1B
+    // the DMA picks this up when the frame being sent is done
+    front_1b = &frames_1b[back_1b];
+    back_1b ^= 1;
+#elif EL_PWM_PLANES && PICO_ON_DEVICE
+    // the DMA IRQ swaps the slots over to it before the next cycle
+    pwm_next_set = back_1b;
+    back_1b ^= 1;
+#elif EL_PWM_PLANES
+    pwm_show(back_1b);
+    back_1b ^= 1;
+#elif !EL_PWM_PLANES && !PICO_ON_DEVICE
+    el_host_send_frame(EL_DISP_WH_HDR, frame_buffer_1b, sizeof(frame_buffer_1b));
+#elif !EL_PWM_PLANES
 
 
     pio_sm_put_blocking(pio0, EL_PIO_SM, EL_DISP_WH_HDR);
@@ -766,10 +1678,12 @@ void draw_1b_buffer(void)
 
     dma_channel_set_read_addr(dma_chan, frame_buffer_1b, true);
 
+#endif
 #endif
 }
 
 
+#if PICO_ON_DEVICE
 static void el_disp_dma_handler(void)
 {
 
@@ -778,6 +1692,21 @@ static void el_disp_dma_handler(void)
     /* Clear the interrupt request. */
     dma_hw->ints1 = 1u << dma_chan;
 
+#if EL_PWM_PLANES
+    // the control channel has already loaded the plane for the next slot, so once the last slot's has been loaded the
+    // slots aren't read again until the next cycle, and can be pointed at a newly split set of planes
+    if (++pwm_slot == EL_PWM_SLOTS - 1 && pwm_next_set >= 0)
+    {
+        pwm_show(pwm_next_set);
+        pwm_next_set = -1;
+    }
+    // the DMA restarts itself; just look for new frames once per cycle of planes
+    if (pwm_slot < EL_PWM_SLOTS)
+    {
+        return;
+    }
+    pwm_slot = 0;
+#endif
     irq_set_pending(LOW_PRIO_IRQ);
 }
 
@@ -798,6 +1727,7 @@ static void el_disp_init(void)
     channel_config_set_read_increment(&cfg, true);
     channel_config_set_dreq(&cfg, DREQ_PIO0_TX0);
 
+#if !EL_PWM_PLANES && !EL_DOUBLE_1B
     dma_channel_configure(
         dma_chan,
         &cfg,
@@ -806,11 +1736,119 @@ static void el_disp_init(void)
         EL_DISP_HEIGHT * EL_DISP_STRIDE / sizeof(uint32_t), /* Number of transfers */
         false                                       /* Don't start yet */
     );
+#elif EL_DOUBLE_1B
+    for (int b = 0; b < NUM_1B_BUFFERS; b++)
+    {
+        frames_1b[b].hdr = EL_DISP_WH_HDR;
+    }
+    ctrl_chan = dma_claim_unused_channel(true);
+    channel_config_set_chain_to(&cfg, ctrl_chan);
+
+    dma_channel_configure(
+        dma_chan,
+        &cfg,
+        &pio0_hw->txf[EL_PIO_SM],                   /* Write address */
+        NULL,                                       /* Read address (set by the control channel) */
+        sizeof(el_1b_frame_t) / sizeof(uint32_t),   /* Number of transfers (header and frame) */
+        false                                       /* Don't start yet */
+    );
+
+    // when a frame is done, the control channel loads front_1b into the data channel and triggers it
+    dma_channel_config ctrl_cfg = dma_channel_get_default_config(ctrl_chan);
+
+    channel_config_set_transfer_data_size(&ctrl_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_cfg, false);
+    channel_config_set_write_increment(&ctrl_cfg, false);
+
+    dma_channel_configure(
+        ctrl_chan,
+        &ctrl_cfg,
+        &dma_hw->ch[dma_chan].al3_read_addr_trig,   /* Write address */
+        &front_1b,                                  /* Read address */
+        1,                                          /* Number of transfers */
+        false                                       /* Don't start yet */
+    );
+#else
+    pwm_init();
+    ctrl_chan = dma_claim_unused_channel(true);
+    channel_config_set_chain_to(&cfg, ctrl_chan);
+
+    dma_channel_configure(
+        dma_chan,
+        &cfg,
+        &pio0_hw->txf[EL_PIO_SM],                   /* Write address */
+        NULL,                                       /* Read address (set by the control channel) */
+        sizeof(el_1b_frame_t) / sizeof(uint32_t),   /* Number of transfers (header and plane) */
+        false                                       /* Don't start yet */
+    );
+
+    // when a plane is done, the control channel loads the next from pwm_slots into the data channel and
+    // triggers it; the read ring wraps back to the first slot, so this runs indefinitely
+    dma_channel_config ctrl_cfg = dma_channel_get_default_config(ctrl_chan);
+
+    channel_config_set_transfer_data_size(&ctrl_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_cfg, true);
+    channel_config_set_write_increment(&ctrl_cfg, false);
+    channel_config_set_ring(&ctrl_cfg, false, __builtin_ctz(sizeof(pwm_slots)));
+
+    dma_channel_configure(
+        ctrl_chan,
+        &ctrl_cfg,
+        &dma_hw->ch[dma_chan].al3_read_addr_trig,   /* Write address */
+        pwm_slots,                                  /* Read address */
+        1,                                          /* Number of transfers */
+        false                                       /* Don't start yet */
+    );
+#endif
 
     dma_channel_set_irq0_enabled(dma_chan, true);
     irq_set_exclusive_handler(DMA_IRQ_0, el_disp_dma_handler);
     irq_set_enabled(DMA_IRQ_0, true);
-}   
+#if EL_PWM_PLANES || EL_DOUBLE_1B
+    dma_channel_start(ctrl_chan);
+#endif
+}
+#else
+static void el_disp_init(void)
+{
+#if EL_PWM_PLANES
+    pwm_init();
+#elif EL_DOUBLE_1B
+    for (int b = 0; b < NUM_1B_BUFFERS; b++)
+    {
+        frames_1b[b].hdr = EL_DISP_WH_HDR;
+    }
+#endif
+    el_host_init();
+}
+
+
+// there is no DMA (or IRQ) on the host, so this stands in for them once per refresh period: the frames that would
+// have been DMAed go to el_host_send_frame, and a conversion pass is run where the DMA IRQ would have pended one
+static void el_host_refresh(void)
+{
+    static uint64_t next_refresh;
+    uint64_t now = time_us_64();
+
+    if (now < next_refresh)
+    {
+        return;
+    }
+    next_refresh = now + EL_HOST_REFRESH_US;
+#if EL_PWM_PLANES
+    for (int s = 0; s < EL_PWM_SLOTS; s++)
+    {
+        el_host_send_frame(pwm_slots[s]->hdr, pwm_slots[s]->bits, sizeof(pwm_slots[s]->bits));
+    }
+#elif EL_DOUBLE_1B
+    el_host_send_frame(front_1b->hdr, front_1b->bits, sizeof(front_1b->bits));
+#endif
+    // (the single buffer is sent at the end of the pass, where the device starts the DMA)
+    EL_TIME_START(t_pass);
+    draw_1b_buffer();
+    EL_TIME_END(EL_TIME_PASS, t_pass);
+}
+#endif   
 
 
 
@@ -818,15 +1856,22 @@ static void core1()
 {
     el_disp_init();
 
+#if PICO_ON_DEVICE
     irq_set_exclusive_handler(LOW_PRIO_IRQ, draw_1b_buffer);
     irq_set_enabled(LOW_PRIO_IRQ, true);
+#endif
 
     sem_release(&core1_launch);
+#if PICO_ON_DEVICE
     irq_set_pending(LOW_PRIO_IRQ);
+#endif
 
     while (true)
     {
         pd_core1_loop();
+#if !PICO_ON_DEVICE
+        el_host_refresh();
+#endif
     }
 }
 
@@ -867,6 +1912,7 @@ void I_InitGraphics(void)
     printf("SW id: %lu\n", sw_number);
 
     stbar = resolve_vpatch_handle(VPATCH_STBAR);
+    dm_rows_init();
     sem_init(&render_frame_ready, 0, 2);
     sem_init(&display_frame_freed, 1, 2);
     sem_init(&core1_launch, 0, 1);
@@ -182,6 +182,15 @@ static inline uint th_read_bits(th_bit_input *bi, int n) {
 #endif
 }
 
+// the first whole byte not yet read; the rest of a partly read byte is skipped
+static inline const uint8_t *th_bit_input_align(th_bit_input *bi) {
+#if TH_USE_ACCUM
+    return bi->cur - bi->bits / 8;
+#else
+    return bi->cur + (bi->bit != 0);
+#endif
+}
+
 static inline uint th_read32(th_bit_input *bi) {
     return th_read_bits(bi, 16) | (th_read_bits(bi, 16) << 16);
 }
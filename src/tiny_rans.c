@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#if PICO_BUILD
+#include "pico.h"
+#else
+#define __not_in_flash_func(x) x
+#endif
+#include <string.h>
+#include "tiny_rans.h"
+
+void __not_in_flash_func(tr_read_decoder)(th_bit_input *bi, uint8_t *slots, uint32_t *syms) {
+    uint8_t symbols[256];
+    uint count = 0;
+    for (uint p = 0; p < 32; p++) {
+        if (th_bit(bi)) {
+            for (uint bit = 0; bit < 8; bit++) {
+                if (th_bit(bi)) {
+                    symbols[count++] = (p << 3) | bit;
+                }
+            }
+        }
+    }
+    assert(count);
+    uint freq_bits = th_read_bits(bi, 4);
+    uint start = 0;
+    for (uint i = 0; i < count; i++) {
+        uint freq = i == count - 1 ? TR_SCALE - start : 1 + (freq_bits ? th_read_bits(bi, freq_bits) : 0);
+        assert(start + freq <= TR_SCALE);
+        syms[symbols[i]] = (freq << 16) | start;
+        memset(slots + start, symbols[i], freq);
+        start += freq;
+    }
+}
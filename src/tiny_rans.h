@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+#include "tiny_huff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// tiny_rans: byte symbols coded with a single 32 bit rANS state, renormalized a byte at a time. a symbol costs a
+// table lookup, a multiply and (sometimes) a byte read, with no per bit loop, so it is quicker to decode than
+// tiny_huff, but the frequency table is bigger and the probabilities are quantized to 1/TR_SCALE, so it is usually a
+// little larger. whd_gen picks between them per lump
+//
+// decoder table (read from a th_bit_input):
+//   32 bits: which groups of 8 symbols are present; for each present group 8 bits saying which of its symbols are
+//   4 bits: freq_bits
+//   freq_bits bits: (frequency - 1) of each present symbol apart from the last (whose frequency makes TR_SCALE)
+// the rANS stream itself starts at the next byte boundary (th_bit_input_align) with the 4 byte big endian state
+
+#define TR_SCALE_BITS 9
+#define TR_SCALE (1u << TR_SCALE_BITS)
+#define TR_LOWER_BOUND (1u << 23)
+#define TR_SYMS_SIZE 256 // words
+
+typedef struct {
+    const uint8_t *cur;
+    uint32_t x;
+} tr_input;
+
+// fills slots (TR_SCALE bytes; the symbol for each slot) and syms (TR_SYMS_SIZE words; frequency << 16 | start of
+// each symbol present)
+void tr_read_decoder(th_bit_input *bi, uint8_t *slots, uint32_t *syms);
+
+static inline void tr_input_init(tr_input *ri, const uint8_t *data) {
+    ri->x = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    ri->cur = data + 4;
+}
+
+static inline uint8_t tr_decode(const uint8_t *slots, const uint32_t *syms, tr_input *ri) {
+    uint s = ri->x & (TR_SCALE - 1);
+    uint8_t symbol = slots[s];
+    uint32_t e = syms[symbol];
+    ri->x = (e >> 16) * (ri->x >> TR_SCALE_BITS) + s - (e & 0xffffu);
+    while (ri->x < TR_LOWER_BOUND) {
+        ri->x = (ri->x << 8) | *ri->cur++;
+    }
+    return symbol;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "d_loop.h"
+#include "w_wad.h"
+#include "w_trace.h"
+
+#define W_TRACE_VERSION 1
+#define MAX_TRACE_LEVELS 256 // as the record's level is a byte
+
+static const char *const category_names[NUM_W_TRACE_CATEGORIES] =
+{
+    [W_TRACE_OTHER] = "other",
+    [W_TRACE_PATCH] = "patch",
+    [W_TRACE_SPRITE] = "sprite",
+    [W_TRACE_FLAT] = "flat",
+    [W_TRACE_MAP] = "map",
+    [W_TRACE_SFX] = "sfx",
+    [W_TRACE_MUSIC] = "music",
+};
+
+typedef struct
+{
+    char name[9];
+    uint32_t *accesses;         // per lump
+} trace_level_t;
+
+static boolean initialized, enabled;
+static const char *prefix;
+static FILE *bin, *ws_csv, *layout;
+static uint8_t *categories;     // per lump
+static trace_level_t levels[MAX_TRACE_LEVELS];
+static int num_levels, cur_level;
+
+static int cur_tic = -1;
+static int *last_tic;           // per lump, the last tic it was used in (or -1)
+static lumpindex_t *tic_lumps;  // lumps used in cur_tic, in order of first use
+static int num_tic_lumps;
+static uint32_t tic_bytes;
+
+
+static FILE *open_output(const char *suffix, const char *mode)
+{
+    char *name = malloc(strlen(prefix) + strlen(suffix) + 1);
+    FILE *f;
+
+    strcpy(name, prefix);
+    strcat(name, suffix);
+    f = fopen(name, mode);
+    if (!f)
+    {
+        fprintf(stderr, "W_TRACE: can't open %s\n", name);
+    }
+    free(name);
+    return f;
+}
+
+
+static uint32_t lump_offset(lumpindex_t lump)
+{
+#if USE_WHD
+    return *lump_info(lump) & 0xffffffu;
+#elif !USE_MEMMAP_ONLY
+    return lump_info(lump)->position;
+#else
+    return 0;
+#endif
+}
+
+
+static void set_category_range(const char *start, const char *end, int category)
+{
+    lumpindex_t first = W_CheckNumForName(start);
+    lumpindex_t last = W_CheckNumForName(end);
+
+    if (first >= 0 && last > first)
+    {
+        memset(categories + first + 1, category, last - first - 1);
+    }
+}
+
+
+static void select_level(const char *name)
+{
+    for (cur_level = 0; cur_level < num_levels; cur_level++)
+    {
+        if (!strncasecmp(levels[cur_level].name, name, 8))
+        {
+            return;
+        }
+    }
+    if (num_levels == MAX_TRACE_LEVELS)
+    {
+        // keep charging the last level
+        cur_level = num_levels - 1;
+        return;
+    }
+    strncpy(levels[num_levels].name, name, 8);
+    levels[num_levels].accesses = calloc(numlumps, sizeof(uint32_t));
+    cur_level = num_levels++;
+}
+
+
+static void end_tic(void)
+{
+    int ws_lumps = 0;
+    uint32_t ws_bytes = 0;
+
+    if (cur_tic < 0)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < numlumps; i++)
+    {
+        if (last_tic[i] >= 0 && last_tic[i] > cur_tic - W_TRACE_WINDOW)
+        {
+            ws_lumps++;
+            ws_bytes += W_LumpLength(i);
+        }
+    }
+    fprintf(ws_csv, "%d,%s,%d,%u,%d,%u\n", cur_tic, levels[cur_level].name, num_tic_lumps, (unsigned int)tic_bytes,
+            ws_lumps, (unsigned int)ws_bytes);
+    for (int i = 0; i < num_tic_lumps; i++)
+    {
+        fprintf(layout, i ? " %d" : "%d", tic_lumps[i]);
+    }
+    fprintf(layout, "\n");
+}
+
+
+static void write_heat(void)
+{
+    FILE *f = open_output(".heat.csv", "w");
+
+    if (!f)
+    {
+        return;
+    }
+    fprintf(f, "level_index,level,lump,category,offset,size,accesses\n");
+    for (int l = 0; l < num_levels; l++)
+    {
+        for (unsigned int i = 0; i < numlumps; i++)
+        {
+            if (levels[l].accesses[i])
+            {
+                fprintf(f, "%d,%s,%u,%s,%u,%d,%u\n", l, levels[l].name, i, category_names[categories[i]],
+                        (unsigned int)lump_offset(i), W_LumpLength(i), (unsigned int)levels[l].accesses[i]);
+            }
+        }
+    }
+    fclose(f);
+}
+
+
+static void finish(void)
+{
+    end_tic();
+    write_heat();
+    fclose(bin);
+    fclose(ws_csv);
+    fclose(layout);
+}
+
+
+static void init(void)
+{
+    w_trace_header_t header = { .magic = { 'W', 'T', 'R', 'C' }, .version = W_TRACE_VERSION, .numlumps = numlumps };
+
+    initialized = true;
+    prefix = getenv("W_TRACE");
+    if (!prefix)
+    {
+        return;
+    }
+    bin = open_output(".bin", "wb");
+    ws_csv = open_output(".ws.csv", "w");
+    layout = open_output(".layout", "w");
+    if (!bin || !ws_csv || !layout)
+    {
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, bin);
+    fprintf(ws_csv, "tic,level,tic_lumps,tic_bytes,window_lumps,window_bytes\n");
+    fprintf(layout, "# lumps used in each tic (whd_gen -layout=)\n");
+
+    categories = calloc(numlumps, 1);
+    last_tic = malloc(numlumps * sizeof(int));
+    tic_lumps = malloc(numlumps * sizeof(lumpindex_t));
+    for (unsigned int i = 0; i < numlumps; i++)
+    {
+        last_tic[i] = -1;
+    }
+    set_category_range("P_START", "P_END", W_TRACE_PATCH);
+    set_category_range("S_START", "S_END", W_TRACE_SPRITE);
+    set_category_range("F_START", "F_END", W_TRACE_FLAT);
+    select_level("-");
+    enabled = true;
+    atexit(finish);
+}
+
+
+void W_TraceLump(lumpindex_t lump)
+{
+    w_trace_record_t r;
+
+    if (!initialized)
+    {
+        init();
+    }
+    if (!enabled)
+    {
+        return;
+    }
+    if (gametic != cur_tic)
+    {
+        end_tic();
+        cur_tic = gametic;
+        num_tic_lumps = 0;
+        tic_bytes = 0;
+    }
+    r.tic = cur_tic;
+    r.lump = lump;
+    r.category = categories[lump];
+    r.level = cur_level;
+    r.offset = lump_offset(lump);
+    r.size = W_LumpLength(lump);
+    fwrite(&r, sizeof(r), 1, bin);
+
+    if (last_tic[lump] != cur_tic)
+    {
+        last_tic[lump] = cur_tic;
+        tic_lumps[num_tic_lumps++] = lump;
+        tic_bytes += r.size;
+    }
+    levels[cur_level].accesses[lump]++;
+}
+
+
+void W_TraceLevel(const char *name, lumpindex_t first_lump, int num_lumps)
+{
+    if (!initialized)
+    {
+        init();
+    }
+    if (!enabled)
+    {
+        return;
+    }
+    select_level(name);
+    if (first_lump >= 0 && first_lump + num_lumps <= (int)numlumps)
+    {
+        memset(categories + first_lump, W_TRACE_MAP, num_lumps);
+    }
+}
+
+
+void W_TraceCategory(lumpindex_t lump, int category)
+{
+    if (!initialized)
+    {
+        init();
+    }
+    if (enabled && lump >= 0)
+    {
+        categories[lump] = category;
+    }
+}
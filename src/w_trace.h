@@ -0,0 +1,73 @@
+#ifndef _W_TRACE_H
+#define _W_TRACE_H
+
+// lump access trace (host builds; cmake -DPICO_DOOM_LUMP_TRACE=TRUE). with W_TRACE=<prefix> set (an environment
+// variable, as the doom_tiny builds have no command line arguments) every W_CacheLumpNum/W_ReadLump is recorded while
+// the game runs (e.g. let a demo play, then quit), and on exit these are written:
+//
+//   <prefix>.bin        w_trace_header_t followed by a w_trace_record_t per access
+//   <prefix>.heat.csv   per level, the accesses to and bytes of each lump used
+//   <prefix>.ws.csv     per tic, the lumps/bytes used in that tic and in the last W_TRACE_WINDOW tics (working set)
+//   <prefix>.layout     per tic, the lumps used (the input for whd_gen -layout=)
+//
+// lumps are read in place from the memory mapped WHD, so an access is the whole lump being fetched by a caller, not
+// the bytes it then reads; callers which keep the pointer (e.g. level geometry) only show up when they fetch it.
+// accesses are charged to the most recently loaded level
+
+#include "doomtype.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef W_TRACE_WINDOW
+#define W_TRACE_WINDOW 35 // one second
+#endif
+
+enum
+{
+    W_TRACE_OTHER,
+    W_TRACE_PATCH,              // P_START ... P_END
+    W_TRACE_SPRITE,             // S_START ... S_END
+    W_TRACE_FLAT,               // F_START ... F_END
+    W_TRACE_MAP,                // a level's marker and data lumps
+    W_TRACE_SFX,
+    W_TRACE_MUSIC,
+    NUM_W_TRACE_CATEGORIES
+};
+
+typedef PACKED_STRUCT({
+    char magic[4];              // "WTRC"
+    uint32_t version;
+    uint32_t numlumps;
+}) w_trace_header_t;
+
+typedef PACKED_STRUCT({
+    uint32_t tic;
+    uint16_t lump;
+    uint8_t category;
+    uint8_t level;              // index of the level in <prefix>.heat.csv; 0 before the first level
+    uint32_t offset;            // of the lump data in the WHD
+    uint32_t size;
+}) w_trace_record_t;
+
+#if W_TRACE
+void W_TraceLump(lumpindex_t lump);
+// called when a level is loaded, with its marker lump and the number of lumps (including the marker) it uses
+void W_TraceLevel(const char *name, lumpindex_t first_lump, int num_lumps);
+// lumps outside the marker ranges that the caller knows the category of
+void W_TraceCategory(lumpindex_t lump, int category);
+#define W_TRACE_LUMP(lump) W_TraceLump(lump)
+#define W_TRACE_LEVEL(name, lump, count) W_TraceLevel(name, lump, count)
+#define W_TRACE_CATEGORY(lump, category) W_TraceCategory(lump, category)
+#else
+#define W_TRACE_LUMP(lump) ((void)0)
+#define W_TRACE_LEVEL(name, lump, count) ((void)0)
+#define W_TRACE_CATEGORY(lump, category) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
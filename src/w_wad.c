@@ -391,7 +391,11 @@ static inline int lump_size(const lumpinfo_t *lump) {
 #if !USE_WHD
     return lump->size;
 #else
-    return ((lump[1] - lump[0])&0xffffffu) - (lump[0]>>30); // just the address of the next minus this one (argh i guess we mauy have alignment issues)
+    if (lump[0] & WHD_LUMP_EXPLICIT_SIZE) {
+        return ((const uint32_t *)(whd_map_base + (lump[0] & 0xffffffu)))[-1];
+    }
+    return ((lump[1] - lump[0])&0xffffffu) - (lump[0]>>30) // just the address of the next minus this one (argh i guess we mauy have alignment issues)
+           - ((lump[1] & WHD_LUMP_EXPLICIT_SIZE) >> 27); // and its size word if it has one
 #endif
 }
 
@@ -426,6 +430,7 @@ void W_ReadLump(lumpindex_t lump, void *dest)
     }
 
     l = lump_info(lump);
+    W_TRACE_LUMP(lump);
 
     V_BeginRead(lump_size(l));
 
@@ -470,6 +475,7 @@ should_be_const void *W_CacheLumpNum(lumpindex_t lumpnum, int tag)
     }
 
     lump = lump_info(lumpnum);
+    W_TRACE_LUMP(lumpnum);
 #if PRINT_TOUCHED_LUMPS
     if (!lump->touched) {
         static int lifetime;
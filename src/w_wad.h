@@ -25,6 +25,7 @@
 
 #include "doomtype.h"
 #include "w_file.h"
+#include "w_trace.h"
 
 
 //
@@ -106,6 +107,7 @@ should_be_const void *W_CacheLumpNum(lumpindex_t lump, int tag);
 #else
 static inline should_be_const void *W_CacheLumpNum(lumpindex_t lumpnum, int tag)
 {
+    W_TRACE_LUMP(lumpnum);
     return lump_data(lump_info(lumpnum));
 }
 #endif
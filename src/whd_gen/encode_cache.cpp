@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "encode_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// bump if the format of the cache files changes
+#define ENCODE_CACHE_VERSION 1
+
+static const char cache_magic[4] = {'W', 'H', 'D', 'C'};
+
+encode_cache lump_cache;
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+void encode_cache::set_dir(std::string d) {
+    dir = std::move(d);
+    if (!enabled()) return;
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0777);
+#endif
+}
+
+std::string encode_cache::path(const std::string &kind, const std::vector<int> &params,
+                               const std::vector<uint8_t> &input) const {
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = fnv1a(h, kind.data(), kind.size());
+    h = fnv1a(h, params.data(), params.size() * sizeof(int));
+    h = fnv1a(h, input.data(), input.size());
+    char name[32];
+    snprintf(name, sizeof(name), "-%016llx", (unsigned long long) h);
+    return dir + "/" + kind + name;
+}
+
+bool encode_cache::load(const std::string &kind, const std::vector<int> &params, const std::vector<uint8_t> &input,
+                        std::vector<uint8_t> &payload) {
+    if (!enabled()) return false;
+    bool hit = false;
+    FILE *f = fopen(path(kind, params, input).c_str(), "rb");
+    if (f) {
+        char magic[4];
+        uint32_t version, param_count, input_size;
+        if (fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, cache_magic, sizeof(magic)) &&
+            fread(&version, sizeof(version), 1, f) == 1 && version == ENCODE_CACHE_VERSION &&
+            fread(&param_count, sizeof(param_count), 1, f) == 1 && param_count == params.size() &&
+            fread(&input_size, sizeof(input_size), 1, f) == 1 && input_size == input.size()) {
+            std::vector<int> file_params(param_count);
+            std::vector<uint8_t> file_input(input_size);
+            if ((!param_count || fread(file_params.data(), sizeof(int), param_count, f) == param_count) &&
+                file_params == params &&
+                (!input_size || fread(file_input.data(), 1, input_size, f) == input_size) &&
+                file_input == input) {
+                payload.clear();
+                uint8_t buf[4096];
+                size_t n;
+                while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+                    payload.insert(payload.end(), buf, buf + n);
+                }
+                hit = !ferror(f);
+            }
+        }
+        fclose(f);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &hm = hits_misses[kind];
+    if (hit) hm.first++;
+    else hm.second++;
+    return hit;
+}
+
+void encode_cache::store(const std::string &kind, const std::vector<int> &params, const std::vector<uint8_t> &input,
+                         const std::vector<uint8_t> &payload) {
+    if (!enabled()) return;
+    std::string final_path = path(kind, params, input);
+    std::string tmp_path = final_path + "." + std::to_string(std::random_device()()) + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        printf("warning: can't write cache file %s\n", tmp_path.c_str());
+        return;
+    }
+    uint32_t version = ENCODE_CACHE_VERSION;
+    uint32_t param_count = params.size();
+    uint32_t input_size = input.size();
+    bool ok = fwrite(cache_magic, sizeof(cache_magic), 1, f) == 1 &&
+              fwrite(&version, sizeof(version), 1, f) == 1 &&
+              fwrite(&param_count, sizeof(param_count), 1, f) == 1 &&
+              fwrite(&input_size, sizeof(input_size), 1, f) == 1 &&
+              fwrite(params.data(), sizeof(int), param_count, f) == param_count &&
+              fwrite(input.data(), 1, input_size, f) == input_size &&
+              fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+    ok &= !fclose(f);
+    // if rename fails someone else (e.g. a duplicate lump on another thread) got there first, which is fine
+    if (!ok || rename(tmp_path.c_str(), final_path.c_str())) {
+        remove(tmp_path.c_str());
+    }
+}
+
+void encode_cache::print_summary() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled()) {
+        printf("Encode cache disabled\n");
+        return;
+    }
+    for (const auto &e : hits_misses) {
+        printf("%20s: cache hits=%d misses=%d\n", e.first.c_str(), e.second.first, e.second.second);
+    }
+}
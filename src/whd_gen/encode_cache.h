@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 20222 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+// on disk cache of per lump encoding results (whd_gen -cache=<dir>), so a rebuild only re-runs the encoding searches
+// for lumps which changed. an entry is keyed by a hash of the lump bytes plus the encoder settings the result depends
+// on, and keeps a copy of the lump bytes so a hash collision is just a miss. entries are written to a temporary file
+// and renamed into place, so the cache is safe to use from the worker threads and from concurrent whd_gen runs
+struct encode_cache {
+    // empty dir disables the cache
+    void set_dir(std::string dir);
+    bool enabled() const { return !dir.empty(); }
+
+    bool load(const std::string &kind, const std::vector<int> &params, const std::vector<uint8_t> &input,
+              std::vector<uint8_t> &payload);
+    void store(const std::string &kind, const std::vector<int> &params, const std::vector<uint8_t> &input,
+               const std::vector<uint8_t> &payload);
+
+    void print_summary();
+
+private:
+    std::string path(const std::string &kind, const std::vector<int> &params, const std::vector<uint8_t> &input) const;
+
+    std::string dir;
+    std::mutex mutex;
+    std::map<std::string, std::pair<int, int>> hits_misses; // by kind
+};
+
+extern encode_cache lump_cache;
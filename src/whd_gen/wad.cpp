@@ -114,7 +114,8 @@ unsigned int W_LumpNameHash(const char *s)
     return result;
 }
 
-void wad::write_whd(const std::string &filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny) {
+void wad::write_whd(const std::string &filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny,
+                    const std::vector<int> &layout) {
     FILE *out = fopen(filename.c_str(), "wb");
     if (!out) throw std::invalid_argument(filename + " can't be opened for write");
 
@@ -184,41 +185,83 @@ void wad::write_whd(const std::string &filename, std::set<std::string> name_requ
     }
 #else
     int base_data_offset = header.infotableofs + (num_lumps + 1) * sizeof(uint32_t) + name_count * 12;
+    auto lump_size = [&](int num) {
+        auto it = lumps.find(num);
+        return it == lumps.end() ? 0 : (int)it->second.data.size();
+    };
+    // lump data goes in the order given by layout, then any remaining lumps in lump order (so without a layout, just
+    // in lump order)
+    std::vector<int> order;
+    std::vector<bool> placed(num_lumps);
+    auto place = [&](int num) {
+        if (num >= 0 && num < num_lumps && !placed[num] && lump_size(num)) {
+            placed[num] = true;
+            order.push_back(num);
+        }
+    };
+    for(int num : layout) place(num);
+    for(const auto &e : lumps) place(e.first);
+    // the runtime gets a lump's size from the next lump's offset, which only works if the next non-empty lump directly
+    // follows; if not the lump is marked WHD_LUMP_EXPLICIT_SIZE, and its size is in the word before its data
+    std::vector<int> next_data(num_lumps);
+    for(int num = num_lumps - 1, next = num_lumps; num >= 0; num--) {
+        next_data[num] = next;
+        if (lump_size(num)) next = num;
+    }
+    std::vector<uint32_t> offsets(num_lumps + 1);
+    std::vector<bool> explicit_size(num_lumps);
     int data_offset = base_data_offset;
-    int num = 0;
-    for(const auto &e : lumps) {
-        while (num < e.first) {
-            write_raw(out, &data_offset);
-            num++;
+    int explicit_size_count = 0;
+    for(int i = 0; i < (int)order.size(); i++) {
+        int num = order[i];
+        int size = lump_size(num);
+        if ((i + 1 < (int)order.size() ? order[i + 1] : num_lumps) != next_data[num]) {
+            explicit_size[num] = true;
+            explicit_size_count++;
+            data_offset += 4;
+            offsets[num] = data_offset | WHD_LUMP_EXPLICIT_SIZE;
+        } else {
+            offsets[num] = data_offset | (((4 - size) & 3) << 30); // store amount to substract off word aligned size to get real size in two high bits
         }
-        const auto& l = e.second;
-        int size = l.data.size();
-        uint32_t combined = data_offset | ((4 -size) << 30); // store amount to substract off word aligned size to get real size in two high bits
-        write_raw(out, &combined);
+        offsets[num] |= lumps[num].whd_flags;
         data_offset += size;
         data_offset = (data_offset + 3) &~3;
-        num++;
+    }
+    if (data_offset > 0xffffff) throw std::invalid_argument("WHD too big");
+    offsets[num_lumps] = data_offset;
+    // empty lumps point at the start of the next lump (including its size word) or the end, so have size zero
+    for(int num = num_lumps - 1; num >= 0; num--) {
+        if (!lump_size(num)) {
+            offsets[num] = (offsets[num + 1] & 0xffffffu) - ((offsets[num + 1] & WHD_LUMP_EXPLICIT_SIZE) ? 4 : 0);
+        }
+    }
+    write_raw(out, offsets.data(), num_lumps + 1);
+    if (!layout.empty()) {
+        printf("WHD LAYOUT %d lumps with explicit size\n", explicit_size_count);
     }
 #endif
-    write_raw(out, &data_offset);
     for(const auto &s : name_required_lower) {
         std::vector<uint8_t> n(10);
         strncpy((char *)n.data(), s.c_str(), 8);
         write_raw(out, n);
         int16_t lnum = get_lump_index(s);
 //        printf("%s %d\n", s.c_str(), lnum);
-        assert(num >= 0);
+        assert(lnum >= 0);
         write_raw(out, &lnum);
     }
     printf("WHD LUMP METADATA %d (%dK)\n", (int)ftell(out), (((int)ftell(out))+512)/1024);
 
     assert(ftell(out) == base_data_offset);
-    for(const auto &e : lumps) {
-        if (e.second.data.size()) {
-            write_raw(out, e.second.data);
-            for(int i=e.second.data.size() & 3; i && i < 4; i++) {
-                fputc(0, out);
-            }
+    for(int num : order) {
+        const auto &data = lumps[num].data;
+        if (explicit_size[num]) {
+            uint32_t size = data.size();
+            write_raw(out, &size);
+        }
+        assert(ftell(out) == (int)(offsets[num] & 0xffffffu));
+        write_raw(out, data);
+        for(int i=data.size() & 3; i && i < 4; i++) {
+            fputc(0, out);
         }
     }
     whdheader.size = ftell(out);
@@ -33,6 +33,7 @@ struct lump {
     std::string name;
     std::vector<uint8_t> data;
     int num = -1;
+    uint32_t whd_flags = 0; // WHD_LUMP_ flags for its lump offset table entry
 };
 
 struct wad {
@@ -41,7 +42,9 @@ struct wad {
     }
     static wad read(const std::string& filename);
     void write(const std::string& filename);
-    void write_whd(const std::string& filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny);
+    // layout optionally gives lump numbers in the order their data should be written (e.g. from an access trace)
+    void write_whd(const std::string& filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny,
+                   const std::vector<int>& layout = {});
 
     std::map<int, lump>& get_lumps() {
         return lumps;
@@ -102,6 +105,7 @@ struct wad {
         }
         lumps[lump.num].num = lump.num; // incase this is a new lump
         lumps[lump.num].data = lump.data;
+        lumps[lump.num].whd_flags = lump.whd_flags;
     }
 
     void remove_lump(const std::string &name) {
@@ -14,9 +14,13 @@
 #include <cstdarg>
 #include <array>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "doomdata.h"
 #include "whddata.h"
 #include "compress_mus.h"
+#include "encode_cache.h"
 #include "lodepng.h"
 #include "statsomizer.h"
 #include "extra_patches.h"
@@ -24,6 +28,7 @@
 #include <vector>
 #include "musx_decoder.h"
 #include "image_decoder.h"
+#include "tiny_rans.h"
 
 //#define USE_PIXELS_ONLY_PATCH 1 // dont use c3 on patches
 #define USE_PIXELS_ONLY_FLAT 1 // dont use c3 on flats
@@ -40,6 +45,38 @@ typedef struct __packed {
 
 
 bool super_tiny = true;
+bool print_cache_stats; // -stats
+const char *layout_trace; // -layout=<trace file>
+// a lump access trace (from a W_TRACE host build, see w_trace.h): a line per tic listing the numbers of the lumps read in
+// that tic; lines starting with # are ignored
+struct lump_trace {
+    std::vector<int> layout;        // the lumps in the order they were first used
+    std::map<int, int> tics_used;   // by lump
+    int tics = 0;
+};
+lump_trace trace;
+// threads used for the per lump encoding that doesn't depend on other lumps (-j<n>; defaults to the host's core count)
+unsigned int worker_threads = std::max(1u, std::thread::hardware_concurrency());
+// guards the stats/counters updated by that encoding; they are all sums/min/max so the order doesn't matter
+std::mutex stats_mutex;
+
+// call fn(0) ... fn(count-1) spread across the worker threads. fn must only touch global state under stats_mutex; the
+// caller then applies the results in index order itself, so the output is the same whatever the thread count
+void parallel_for(int count, const std::function<void(int)> &fn) {
+    int nthreads = (int)std::min(worker_threads, (unsigned int)std::max(count, 0));
+    if (nthreads <= 1) {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; t++) {
+        threads.emplace_back([&]() {
+            for (int i; (i = next++) < count;) fn(i);
+        });
+    }
+    for (auto &t : threads) t.join();
+}
 
 using std::vector;
 
@@ -769,7 +806,7 @@ T get_field_inc(const std::vector<uint8_t> &data, int &offset) {
 }
 
 static void usage() {
-    throw std::invalid_argument("usage: whd_gen <wad_in> <whd_out>");
+    throw std::invalid_argument("usage: whd_gen <wad_in> <whd_out> [-no-super-tiny] [-j<threads>] [-cache=<dir>] [-stats] [-layout=<trace>] [-flat-decode-weight=<bytes per 1000 cycles>]");
 }
 
 std::set<std::string> music_lumpnames = {
@@ -953,7 +990,7 @@ std::set<std::string> sfx_lumpnames = {
         "dsradio",
 };
 
-bool convert_sound(std::pair<const int, lump> &e);
+bool convert_sound(std::pair<const int, lump> &e, bool encoded, std::vector<uint8_t> &out);
 
 void dump_patch(const char *name, int num, lump &patch);
 
@@ -1101,22 +1138,27 @@ std::vector<std::vector<uint8_t>> to_merged_posts(const std::vector<int16_t>& pi
                 non_transparent += pix[i + y * width] >= 0;
                 //                pix[i + y * ph.width] = 0xfc;
             }
+            std::lock_guard<std::mutex> lock(stats_mutex);
             same_columns.record(non_transparent);
         }
     }
 #endif
+    int opaque = 0, transparent = 0;
     for(int x=0;x<(int)width;x++) {
         if (!same[x]) {
             for(int y = 0; y < (int)(width * height); y += width) {
                 if (pix[x+y]>=0) {
                     merged_posts[x].push_back(pix[x+y]);
-                    opaque_pixels++;
+                    opaque++;
                 } else {
-                    transparent_pixels++;
+                    transparent++;
                 }
             }
         }
     }
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    opaque_pixels += opaque;
+    transparent_pixels += transparent;
     return merged_posts;
 }
 
@@ -1455,6 +1497,7 @@ uint consider_compress3(const std::string& name, const std::vector<std::vector<u
     uncreate_bip(biv, bi);
 #endif
 
+    std::lock_guard<std::mutex> lock(stats_mutex);
     cp1_size.record(result.size());
     return result.size();
 }
@@ -1476,6 +1519,7 @@ uint consider_compress_pixels_only(const std::string& name, const std::vector<st
                 zposts[x] = std::make_shared<byte_vector_bit_output>();
                 wrappers.begin_output(zposts[x]);
             } else {
+                std::lock_guard<std::mutex> lock(stats_mutex);
                 cp1_pixels.record(post.size());
             }
             for(uint y=0;y<post.size();y++) {
@@ -1519,7 +1563,10 @@ uint consider_compress_pixels_only(const std::string& name, const std::vector<st
         col_bo->write_to(check);
     }
     auto result = check->get_output();
-    cp_po_size.record(result.size());
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        cp_po_size.record(result.size());
+    }
 #if 1 // must be 1 now as we set have to set decoder_size
     byte_vector_bit_input biv(result);
     auto bi = create_bip(biv);
@@ -1655,15 +1702,60 @@ const uint8_t bitcount8_table[256] = {
         8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
         };
 
-void convert_patch(wad &wad, int num, lump &patch) {
-    dump_patch(patch.name.c_str(), num, patch);
+// everything other than the lump bytes that the (cached) results of encode_patch and encode_sound depend on; bump the
+// first value when either of them changes
+std::vector<int> encoder_params() {
+    return {
+        1,
+        super_tiny,
+#ifdef USE_PIXELS_ONLY_PATCH
+        1,
+#else
+        0,
+#endif
+        LOOKAHEAD,
+    };
+}
+
+void append_bits(std::vector<uint8_t> &data, const byte_vector_bit_output &bo) {
+    auto padded = bo;
+    auto bytes = padded.get_output();
+    append_field(data, (uint32_t)bo.bit_size());
+    data.insert(data.end(), bytes.begin(), bytes.end());
+}
+
+std::shared_ptr<byte_vector_bit_output> get_bits_inc(const std::vector<uint8_t> &data, int &offset) {
+    uint bit_size = get_field_inc<uint32_t>(data, offset);
+    assert(offset + (bit_size + 7) / 8 <= data.size());
+    auto bo = std::make_shared<byte_vector_bit_output>();
+    for (uint i = 0; i < bit_size / 8; i++) {
+        bo->write(bit_sequence(data[offset++], 8));
+    }
+    if (bit_size & 7) {
+        bo->write(bit_sequence(data[offset++] & ((1u << (bit_size & 7)) - 1), bit_size & 7));
+    }
+    return bo;
+}
+
+// the part of patch conversion which only looks at the patch itself, so can be done for many patches at once
+struct patch_encoding {
+    std::vector<int16_t> pix;
+    std::vector<std::vector<uint8_t>> posts;
+    std::vector<int> same;
+    bool have_same;
+    int choice;
+    uint best;
+    std::vector<std::shared_ptr<byte_vector_bit_output>> best_zposts;
+    std::shared_ptr<byte_vector_bit_output> best_decoder_output;
+    uint best_decoder_size;
+};
+
+patch_encoding encode_patch(lump &patch) {
+    patch_encoding enc;
     auto ph = get_field<patch_header>(patch.data, 0);
-    auto pix = unpack_patch(patch);
-    converted_patch_count++;
+    auto& pix = enc.pix;
+    pix = unpack_patch(patch);
     assert(ph.height < 256);
-#if DEBUG_SAVE_PNG
-    save_png(wad, "raw", patch.name, ph.width, ph.height, pix);
-#endif
 #if 0
     const int bigoff = 6;
     for(auto& p : pix) {
@@ -1795,29 +1887,36 @@ for(int y=0;y<ph.height-1;y++) {
         }
     }
 #endif
-#if DEBUG_SAVE_PNG
-    save_png(wad, "flat", patch.name, ph.width, ph.height, pix);
-#endif
-    int choice = 0;
-    uint best = std::numeric_limits<uint>::max();
+    enc.choice = 0;
+    enc.best = std::numeric_limits<uint>::max();
     std::vector<std::shared_ptr<byte_vector_bit_output>> zposts;
     std::shared_ptr<byte_vector_bit_output> decoder_output;
-    std::vector<std::shared_ptr<byte_vector_bit_output>> best_zposts;
-    std::shared_ptr<byte_vector_bit_output> best_decoder_output;
     uint decoder_size;
-    uint best_decoder_size;
     auto choose = [&](int c, uint size) {
-        if (size < best) {
-            choice = c;
-            best = size;
-            best_zposts = zposts;
-            best_decoder_output = std::make_shared<byte_vector_bit_output>(*decoder_output);
-            best_decoder_size = decoder_size;
+        if (size < enc.best) {
+            enc.choice = c;
+            enc.best = size;
+            enc.best_zposts = zposts;
+            enc.best_decoder_output = std::make_shared<byte_vector_bit_output>(*decoder_output);
+            enc.best_decoder_size = decoder_size;
         }
     };
-    std::vector<int> same;
-    bool have_same;
-    auto posts = to_merged_posts(pix, ph.width, ph.height, same, have_same);
+    auto& posts = enc.posts;
+    posts = to_merged_posts(pix, ph.width, ph.height, enc.same, enc.have_same);
+    std::vector<uint8_t> cached;
+    if (lump_cache.load("patch", encoder_params(), patch.data, cached)) {
+        int offset = 0;
+        enc.choice = get_field_inc<uint32_t>(cached, offset);
+        enc.best = get_field_inc<uint32_t>(cached, offset);
+        enc.best_decoder_size = get_field_inc<uint32_t>(cached, offset);
+        enc.best_decoder_output = get_bits_inc(cached, offset);
+        enc.best_zposts.resize(ph.width);
+        for (auto &zpost : enc.best_zposts) {
+            zpost = get_bits_inc(cached, offset);
+        }
+        assert(offset == (int)cached.size());
+        return enc;
+    }
     // i think 0 and 3 may be fine on their own
     choose(0, consider_compress_pixels_only(patch.name, posts, decoder_output, zposts, ph.width, ph.height, decoder_size));
 #if !USE_PIXELS_ONLY_PATCH
@@ -1826,6 +1925,35 @@ for(int y=0;y<ph.height-1;y++) {
     // todo put this back if we need 5K
 //    choose(3, consider_compress1(patch.name, posts, ph.width, ph.height, 2, 8));
 #endif
+    if (lump_cache.enabled()) {
+        append_field(cached, (uint32_t)enc.choice);
+        append_field(cached, (uint32_t)enc.best);
+        append_field(cached, (uint32_t)enc.best_decoder_size);
+        append_bits(cached, *enc.best_decoder_output);
+        assert((int)enc.best_zposts.size() == ph.width);
+        for (const auto &zpost : enc.best_zposts) {
+            append_bits(cached, *zpost);
+        }
+        lump_cache.store("patch", encoder_params(), patch.data, cached);
+    }
+    return enc;
+}
+
+void convert_patch(wad &wad, int num, lump &patch, const patch_encoding &enc) {
+    dump_patch(patch.name.c_str(), num, patch);
+    auto ph = get_field<patch_header>(patch.data, 0);
+    converted_patch_count++;
+#if DEBUG_SAVE_PNG
+    save_png(wad, "raw", patch.name, ph.width, ph.height, unpack_patch(patch));
+    save_png(wad, "flat", patch.name, ph.width, ph.height, enc.pix);
+#endif
+    int choice = enc.choice;
+    uint best = enc.best;
+    const auto& posts = enc.posts;
+    const auto& same = enc.same;
+    const auto& best_zposts = enc.best_zposts;
+    const auto& best_decoder_output = enc.best_decoder_output;
+    uint best_decoder_size = enc.best_decoder_size;
     winners[choice]++;
     cp_size.record(best);
     converted_patch_size += ph.width * ph.height;
@@ -2021,6 +2149,10 @@ for(int y=0;y<ph.height-1;y++) {
     touched[num] = TOUCHED_PATCH;
 }
 
+void convert_patch(wad &wad, int num, lump &patch) {
+    convert_patch(wad, num, patch, encode_patch(patch));
+}
+
 // use_runs = true to do runs of pixels, false to use 0 as transparent color
 void convert_vpatch(wad &wad, lump &patch, int max_colors, bool use_runs, std::set<int> colors, int shared_palette_handle, bool first) {
     touched[patch.num] = TOUCHED_VPATCH;
@@ -2255,6 +2387,7 @@ void convert_patches(wad &wad, std::string from_name, std::string to_name) {
     std::set<int> pname_patches;
 
     std::set<std::string> temp_hack;
+    std::vector<lump> patches;
     for (int num = start + 1; num < end; num++) {
         lump patch;
         if (wad.get_lump(num, patch)) {
@@ -2268,11 +2401,19 @@ void convert_patches(wad &wad, std::string from_name, std::string to_name) {
             // for now remove the data
             //wad.remove_lump(name);
 
-            convert_patch(wad, num, patch);
+            patches.push_back(patch);
         } else {
             printf("  %d - not found\n", num);
         }
     }
+    // the compression search is independent per patch; everything else happens in lump order below
+    std::vector<patch_encoding> encodings(patches.size());
+    parallel_for(patches.size(), [&](int i) {
+        encodings[i] = encode_patch(patches[i]);
+    });
+    for (int i = 0; i < (int)patches.size(); i++) {
+        convert_patch(wad, patches[i].num, patches[i], encodings[i]);
+    }
 }
 
 void dump_patch(const char *name, int num, lump &patch) {
@@ -4260,6 +4401,232 @@ texture_index convert_textures(wad &wad) {
 }
 
 statsomizer flat_rawsize("Flat raw size");
+// rough M0+ cycle counts for the two flat decoders in decode_flat_to_slot, estimated from the instructions in their
+// inner loops. they only have to be good enough to compare the two against each other
+#define HUFF_FLAT_SETUP_CYCLES 3000     // reading the decoder and th_make_prefix_length_table
+#define HUFF_PIXEL_CYCLES 28            // a code of up to 8 bits
+#define HUFF_LONG_CODE_CYCLES 10        // the slow path for longer codes...
+#define HUFF_LONG_CODE_BIT_CYCLES 12    // ...and per bit beyond 8
+#define RANS_FLAT_SETUP_CYCLES 1500     // tr_read_decoder (mostly filling the slots)
+#define RANS_PIXEL_CYCLES 16
+#define RANS_BYTE_CYCLES 6              // renormalization
+#define COLUMN_COPY_CYCLES 60
+// lumps used in at least this many tics of the -layout trace (10 seconds) are as hot as it gets
+#define HOT_LUMP_TICS 350
+
+// what the decode time of a flat is worth against its size (-flat-decode-weight=<bytes per 1000 cycles>)
+double flat_decode_weight = 4;
+
+statsomizer flat_rans_extra_size("Flat rANS extra size");
+statsomizer flat_rans_kcycles_saved("Flat rANS kcycles saved");
+
+// decode_flat_to_slot's tiny_huff path on the host, returning the estimated cycles it takes
+uint huff_flat_decode_cycles(std::vector<uint8_t> data, uint8_t *flat_data) {
+    uint16_t buf[WHD_FLAT_DECODER_MAX_SIZE];
+    uint8_t tmp[WHD_FLAT_DECODER_MAX_SIZE];
+    th_bit_input bi;
+    data.push_back(0); // th_decode_table_special looks at the byte after the one it is in
+    th_sized_bit_input_init(&bi, data.data(), data.size() - 1);
+    auto bit_pos = [&]() { return (uint)(bi.cur - data.data()) * 8 + bi.bit; };
+    uint cycles = HUFF_FLAT_SETUP_CYCLES;
+    auto decode_pixel = [&]() {
+        uint before = bit_pos();
+        uint8_t pixel = th_decode_table_special(buf, tmp, &bi);
+        uint length = bit_pos() - before;
+        cycles += HUFF_PIXEL_CYCLES;
+        if (length > 8) cycles += HUFF_LONG_CODE_CYCLES + (length - 8) * HUFF_LONG_CODE_BIT_CYCLES;
+        return pixel;
+    };
+    if (th_bit(&bi)) {
+        th_read_simple_decoder(&bi, buf, count_of(buf), tmp, count_of(tmp));
+    } else {
+        read_raw_pixels_decoder(&bi, buf, count_of(buf), tmp, count_of(tmp));
+    }
+    th_make_prefix_length_table(buf, tmp);
+    bool have_same = th_bit(&bi);
+    for (int x = 0; x < 64; x++) {
+        uint8_t *p = &flat_data[x * 64];
+        if (have_same && th_bit(&bi)) {
+            uint xf = th_read_bits(&bi, bitcount8_table[x]);
+            memcpy(p, &flat_data[xf * 64], 64);
+            cycles += COLUMN_COPY_CYCLES;
+        } else {
+            for (int y = 0; y < 64; y++) {
+                *p++ = decode_pixel();
+            }
+        }
+    }
+    return cycles;
+}
+
+// decode_flat_to_slot's tiny_rans path on the host, returning the estimated cycles it takes
+uint rans_flat_decode_cycles(const std::vector<uint8_t> &data, uint8_t *flat_data) {
+    uint32_t syms[TR_SYMS_SIZE];
+    uint8_t slots[TR_SCALE];
+    th_bit_input bi;
+    th_sized_bit_input_init(&bi, data.data(), data.size());
+    tr_read_decoder(&bi, slots, syms);
+    uint8_t same[64];
+    bool have_same = th_bit(&bi);
+    for (int x = 0; x < 64; x++) {
+        same[x] = have_same && th_bit(&bi) ? th_read_bits(&bi, bitcount8_table[x]) + 1 : 0;
+    }
+    tr_input ri;
+    tr_input_init(&ri, th_bit_input_align(&bi));
+    uint cycles = RANS_FLAT_SETUP_CYCLES;
+    for (int x = 0; x < 64; x++) {
+        uint8_t *p = &flat_data[x * 64];
+        if (same[x]) {
+            memcpy(p, &flat_data[(same[x] - 1) * 64], 64);
+            cycles += COLUMN_COPY_CYCLES;
+        } else {
+            for (int y = 0; y < 64; y++) {
+                *p++ = tr_decode(slots, syms, &ri);
+            }
+        }
+    }
+    size_t header_bytes = th_bit_input_align(&bi) - data.data();
+    size_t stream_bytes = ri.cur - th_bit_input_align(&bi);
+    if (header_bytes + stream_bytes != data.size()) fail("tiny_rans flat size mismatch");
+    return cycles + (64 - std::count_if(same, same + 64, [](uint8_t s) { return s != 0; })) * 64 * RANS_PIXEL_CYCLES +
+           stream_bytes * RANS_BYTE_CYCLES;
+}
+
+// frequencies for the symbol counts summing to TR_SCALE, each present symbol getting at least 1, placed to lose the
+// fewest bits
+std::vector<uint> normalize_frequencies(const std::vector<uint> &counts) {
+    uint total = 0;
+    for (uint c : counts) total += c;
+    std::vector<uint> freqs(counts.size());
+    int sum = 0;
+    for (int i = 0; i < (int)counts.size(); i++) {
+        if (counts[i]) {
+            freqs[i] = std::max(1u, (uint)((uint64_t)counts[i] * TR_SCALE / total));
+            sum += freqs[i];
+        }
+    }
+    while (sum != (int)TR_SCALE) {
+        int best = -1;
+        double best_cost = std::numeric_limits<double>::max();
+        for (int i = 0; i < (int)counts.size(); i++) {
+            if (!counts[i] || (sum > (int)TR_SCALE && freqs[i] == 1)) continue;
+            // bits lost by the change (negative if it gains)
+            double cost = sum < (int)TR_SCALE ? -(counts[i] * std::log2((freqs[i] + 1.0) / freqs[i])) :
+                          counts[i] * std::log2(freqs[i] / (freqs[i] - 1.0));
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = i;
+            }
+        }
+        assert(best >= 0);
+        int delta = sum < (int)TR_SCALE ? 1 : -1;
+        freqs[best] += delta;
+        sum += delta;
+    }
+    return freqs;
+}
+
+// the tiny_rans coding of a flat (see decode_flat_to_slot): the pixels of the columns which aren't copies of earlier
+// ones (same[x] != 0 if have_same) go in one rANS stream after the bit coded header
+std::vector<uint8_t> encode_rans_flat(const std::vector<int16_t> &pix, bool have_same, const std::vector<int> &same) {
+    std::vector<uint8_t> pixels;
+    for (int x = 0; x < 64; x++) {
+        if (have_same && same[x]) continue;
+        for (int y = 0; y < 64; y++) {
+            pixels.push_back(pix[x + y * 64]);
+        }
+    }
+    std::vector<uint> counts(256);
+    for (uint8_t p : pixels) counts[p]++;
+    auto freqs = normalize_frequencies(counts);
+    std::vector<uint> starts(256);
+    uint start = 0, max_freq_minus_one = 0;
+    int last_symbol = -1;
+    for (int i = 0; i < 256; i++) {
+        if (freqs[i]) last_symbol = i;
+    }
+    for (int i = 0; i < 256; i++) {
+        starts[i] = start;
+        start += freqs[i];
+        if (freqs[i] && i != last_symbol) max_freq_minus_one = std::max(max_freq_minus_one, freqs[i] - 1);
+    }
+    assert(start == TR_SCALE);
+
+    byte_vector_bit_output bo;
+    for (int p = 0; p < 32; p++) {
+        bool any = false;
+        for (int bit = 0; bit < 8; bit++) any |= freqs[p * 8 + bit] != 0;
+        bo.write(bit_sequence(any, 1));
+        if (any) {
+            for (int bit = 0; bit < 8; bit++) bo.write(bit_sequence(freqs[p * 8 + bit] != 0, 1));
+        }
+    }
+    uint freq_bits = max_freq_minus_one ? 32 - __builtin_clz(max_freq_minus_one) : 0;
+    bo.write(bit_sequence(freq_bits, 4));
+    for (int i = 0; i < 256; i++) {
+        if (freqs[i] && i != last_symbol && freq_bits) bo.write(bit_sequence(freqs[i] - 1, freq_bits));
+    }
+    bo.write(bit_sequence(have_same, 1));
+    for (int x = 0; x < 64 && have_same; x++) {
+        bo.write(bit_sequence(same[x] != 0, 1));
+        if (same[x]) bo.write(bit_sequence(same[x] - 1, bitcount8_table[x]));
+    }
+    auto data = bo.get_output();
+
+    // encoded last pixel first, so the bytes come out backwards
+    std::vector<uint8_t> stream;
+    uint32_t x = TR_LOWER_BOUND;
+    for (int i = (int)pixels.size() - 1; i >= 0; i--) {
+        uint freq = freqs[pixels[i]];
+        uint32_t x_max = ((TR_LOWER_BOUND >> TR_SCALE_BITS) << 8) * freq;
+        while (x >= x_max) {
+            stream.push_back(x & 0xff);
+            x >>= 8;
+        }
+        x = ((x / freq) << TR_SCALE_BITS) + (x % freq) + starts[pixels[i]];
+    }
+    for (int i = 0; i < 4; i++) {
+        stream.push_back(x & 0xff);
+        x >>= 8;
+    }
+    data.insert(data.end(), stream.rbegin(), stream.rend());
+    return data;
+}
+
+// how much a flat's decode time counts against its size: flat_decode_weight, scaled down for flats the -layout trace
+// (if any) shows were rarely used, so they keep the densest coding
+double flat_decode_time_weight(int lump_num) {
+    if (!trace.tics) return flat_decode_weight;
+    auto it = trace.tics_used.find(lump_num);
+    int used = it == trace.tics_used.end() ? 0 : it->second;
+    return flat_decode_weight * std::min(1.0, used / (double)HOT_LUMP_TICS);
+}
+
+// the tiny_huff or tiny_rans coding of a flat, whichever costs less in size plus weighted decode time
+void choose_flat_coding(lump &lump, const std::vector<int16_t> &pix, std::vector<uint8_t> huff, bool have_same,
+                        const std::vector<int> &same) {
+    std::vector<uint8_t> expected(4096), decoded(4096);
+    for (int x = 0; x < 64; x++) {
+        for (int y = 0; y < 64; y++) {
+            expected[x * 64 + y] = pix[x + y * 64];
+        }
+    }
+    uint huff_cycles = huff_flat_decode_cycles(huff, decoded.data());
+    if (decoded != expected) fail("tiny_huff flat round trip mismatch %s", lump.name.c_str());
+    auto rans = encode_rans_flat(pix, have_same, same);
+    uint rans_cycles = rans_flat_decode_cycles(rans, decoded.data());
+    if (decoded != expected) fail("tiny_rans flat round trip mismatch %s", lump.name.c_str());
+    double weight = flat_decode_time_weight(lump.num) / 1000;
+    if (rans.size() + rans_cycles * weight < huff.size() + huff_cycles * weight) {
+        flat_rans_extra_size.record((int)rans.size() - (int)huff.size());
+        flat_rans_kcycles_saved.record(((int)huff_cycles - (int)rans_cycles) / 1000);
+        lump.data = rans;
+        lump.whd_flags |= WHD_LUMP_FLAT_RANS;
+    } else {
+        lump.data = huff;
+    }
+}
+
 statsomizer flat_c2size("Flat c2 size");
 statsomizer flat_colors("Flat colors");
 statsomizer flat_under_colors[] = {
@@ -4370,7 +4737,7 @@ void convert_flats(wad &wad) {
             }
             compressed.insert(f);
             touched[f] = TOUCHED_FLAT;
-            lump.data = final_bo.get_output();
+            choose_flat_coding(lump, pix, final_bo.get_output(), have_same, same);
             flat_c2size.record(lump.data.size());
             wad.update_lump(lump);
             flat_colors.record(colors.size());
@@ -4583,19 +4950,20 @@ adpcm_encode_data(const std::vector<int16_t> &in, std::vector<uint8_t> &out, int
     return 0;
 }
 
-bool convert_sound(std::pair<const int, lump> &e) {
-    auto &lump = e.second;
+bool is_dmx_sound(const lump &lump) {
+    // Check the header, and ensure this is a valid sound
+    return lump.data.size() >= 8 && lump.data[0] == 0x03 && lump.data[1] == 0x00;
+}
+
+bool adpcm_encode_sound(const lump &lump, std::vector<uint8_t> &out) {
     const int lumplen = lump.data.size();
     const uint8_t *data = lump.data.data();
-    // Check the header, and ensure this is a valid sound
 
-    if (lumplen < 8
-        || data[0] != 0x03 || data[1] != 0x00) {
+    if (!is_dmx_sound(lump)) {
         // Invalid sound
         return false;
     }
 
-    name_required.insert(lump.name);
     // 16 bit sample rate field, 32 bit length field
 
     int samplerate = (data[3] << 8) | data[2];
@@ -4620,7 +4988,7 @@ bool convert_sound(std::pair<const int, lump> &e) {
     // The DMX sound library seems to skip the first 16 and last 16
     // bytes of the lump - reason unknown.
 
-    std::vector<uint8_t> out;
+    out.clear();
     out.insert(out.end(), data, data + 8); // copy the original header
     out[1] = 0x80; // something difference
 
@@ -4642,6 +5010,31 @@ bool convert_sound(std::pair<const int, lump> &e) {
     ) < 0) {
         return false;
     }
+    return true;
+}
+
+// ADPCM encode a DMX sound lump into out; false if it isn't a valid sound (or can't be encoded). only looks at the
+// lump itself, so can be done for many sounds at once
+bool encode_sound(const lump &lump, std::vector<uint8_t> &out) {
+    std::vector<uint8_t> cached;
+    if (lump_cache.load("sound", encoder_params(), lump.data, cached)) {
+        assert(!cached.empty());
+        out.assign(cached.begin() + 1, cached.end());
+        return cached[0];
+    }
+    bool ok = adpcm_encode_sound(lump, out);
+    if (lump_cache.enabled()) {
+        cached.push_back(ok);
+        cached.insert(cached.end(), out.begin(), out.end());
+        lump_cache.store("sound", encoder_params(), lump.data, cached);
+    }
+    return ok;
+}
+
+bool convert_sound(std::pair<const int, lump> &e, bool encoded, std::vector<uint8_t> &out) {
+    if (!is_dmx_sound(e.second)) return false;
+    name_required.insert(e.second.name);
+    if (!encoded) return false;
     compressed.insert(e.first);
     sfx_orig_size.record(e.second.data.size());
     e.second.data = out;
@@ -4716,6 +5109,40 @@ std::vector<uint8_t> png_to_patch(wad& wad, const char *prefix, const char *name
 }
 #endif
 
+// read the -layout trace. write_whd lays the lump data out in the order the lumps were first used, which keeps the
+// lumps used together (a level's geometry and the textures and sprites it starts with, then those first seen later)
+// next to each other in flash, so they share XIP cache lines and the cache spends less time refilling. the number of
+// tics each lump was used in is how hot it is for choose_flat_coding
+lump_trace read_lump_trace(const char *filename) {
+    FILE *in = fopen(filename, "r");
+    if (!in) throw std::invalid_argument(std::string(filename) + " not found");
+    lump_trace t;
+    std::set<int> seen, seen_this_tic;
+    bool comment = false, line_start = true;
+    int c, num = -1;
+    do {
+        c = fgetc(in);
+        if (line_start && c == '#') comment = true;
+        if (line_start) seen_this_tic.clear();
+        line_start = c == '\n';
+        if (isdigit(c)) {
+            if (!comment) num = std::max(num, 0) * 10 + (c - '0');
+        } else {
+            if (num >= 0) {
+                // only lines with lumps on count as tics, so blank lines don't make every lump look colder
+                if (seen_this_tic.empty()) t.tics++;
+                if (seen.insert(num).second) t.layout.push_back(num);
+                if (seen_this_tic.insert(num).second) t.tics_used[num]++;
+            }
+            num = -1;
+            if (c == '\n') comment = false;
+        }
+    } while (c != EOF);
+    fclose(in);
+    printf("Layout from %s: %d lumps over %d tics\n", filename, (int)t.layout.size(), t.tics);
+    return t;
+}
+
 int main(int argc, const char **argv) {
     hash = 0;
     int argn = 1;
@@ -4726,6 +5153,16 @@ int main(int argc, const char **argv) {
         }
         if (!strcmp(argv[argn], "-no-super-tiny")) {
             super_tiny = false;
+        } else if (!strncmp(argv[argn], "-j", 2)) {
+            worker_threads = std::max(1, atoi(argv[argn] + 2));
+        } else if (!strncmp(argv[argn], "-cache=", 7)) {
+            lump_cache.set_dir(argv[argn] + 7);
+        } else if (!strcmp(argv[argn], "-stats") || !strcmp(argv[argn], "--stats")) {
+            print_cache_stats = true;
+        } else if (!strncmp(argv[argn], "-layout=", 8)) {
+            layout_trace = argv[argn] + 8;
+        } else if (!strncmp(argv[argn], "-flat-decode-weight=", 20)) {
+            flat_decode_weight = atof(argv[argn] + 20);
         }
         return argv[argn++];
     };
@@ -4738,7 +5175,8 @@ int main(int argc, const char **argv) {
         }
         printf("LUMPS ORIG SIZE %d\n", size);
         auto output_filename = next_arg();
-        next_arg(false); // check for more options
+        while (next_arg(false)) {} // check for more options
+        if (layout_trace) trace = read_lump_trace(layout_trace);
         const char *pos = std::max(strrchr(wad_name, '\\'), strrchr(wad_name, '/'));
         if (pos) pos++;
         else pos = wad_name;
@@ -4956,14 +5394,24 @@ int main(int argc, const char **argv) {
 
         convert_flats(wad);
         // filter again
+        std::vector<std::pair<const int, lump> *> sounds;
         for (auto &e : wad.get_lumps()) {
             if (sfx_lumpnames.find(to_lower(e.second.name)) != sfx_lumpnames.end()) {
-                if (!convert_sound(e)) {
-                    printf("Failed to convert sound %s\n", e.second.name.c_str());
-                    // todo remove?
-                }
-                touched[e.first] = TOUCHED_SFX;
+                sounds.push_back(&e);
+            }
+        }
+        std::vector<std::vector<uint8_t>> encoded_sounds(sounds.size());
+        std::vector<char> sound_ok(sounds.size());
+        parallel_for(sounds.size(), [&](int i) {
+            sound_ok[i] = encode_sound(sounds[i]->second, encoded_sounds[i]);
+        });
+        for (int i = 0; i < (int)sounds.size(); i++) {
+            auto &e = *sounds[i];
+            if (!convert_sound(e, sound_ok[i], encoded_sounds[i])) {
+                printf("Failed to convert sound %s\n", e.second.name.c_str());
+                // todo remove?
             }
+            touched[e.first] = TOUCHED_SFX;
         }
         for (auto &e : wad.get_lumps()) {
             if (e.second.name.substr(0, 5) == "WIMAP") {
@@ -5261,6 +5709,8 @@ int main(int argc, const char **argv) {
         for(i=0;i<(int)fwinners.size();i++) {
             printf("FWIN %d %d\n", i, fwinners[i]);
         }
+        flat_rans_extra_size.print_summary();
+        flat_rans_kcycles_saved.print_summary();
 
         color_runs.print_summary();
         side_meta.print_summary();
@@ -5272,7 +5722,9 @@ int main(int argc, const char **argv) {
         demo_size_orig.print_summary();
         demo_size.print_summary();
         single_patch_metadata_size.print_summary();
-        wad.write_whd(output_filename, name_required, hash, super_tiny);
+        if (print_cache_stats) lump_cache.print_summary();
+        wad.write_whd(output_filename, name_required, hash, super_tiny,
+                      trace.layout);
         size = 0;
         for(const auto &e : wad.get_lumps()) {
             size += e.second.data.size();
@@ -770,6 +770,16 @@ typedef PACKED_STRUCT({
 static_assert(sizeof(whdheader_t)==24, "");
 extern const whdheader_t *whdheader;
 
+// lump offset table entries are a 24 bit offset; normally the lump size is the distance to the next lump's offset
+// less the amount in the top two bits. whd_gen -layout=<trace> moves lump data out of lump order, and a lump which isn't
+// followed by the next lump has this bit set, and its size in the word before its data (so the lump before it must
+// also allow for that word)
+#define WHD_LUMP_EXPLICIT_SIZE (1u << 29)
+// a flat whose pixels are coded with tiny_rans rather than tiny_huff has this bit set; rANS decodes faster, so whd_gen
+// uses it for the flats where the decode time saved is worth more than the extra size. it is a flag here rather than
+// in the flat data, so tiny_huff flats (and WHDs made before there was a choice) are unchanged
+#define WHD_LUMP_FLAT_RANS (1u << 28)
+
 #define WHD_MAX_COL_SEGS 8 // todo may be smaller
 #define WHD_MAX_COL_UNIQUE_PATCHES 4  // 4 * 128 = 512 which is how big we like to keep the decoder_tmp in pd_render_nh (when used for decoding)
 